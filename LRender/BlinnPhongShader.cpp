@@ -1,4 +1,5 @@
-#include "blinnPhongShader.h"
+#include "BlinnPhongShader.h"
+#include <immintrin.h>
 
 glm::mat4 mat4_combine(glm::mat4 m[4], Vector4D weights_) {
     glm::mat4 combined(0.0);
@@ -44,29 +45,34 @@ void BlinnPhongShader::vertexShader(Vertex &vertex, bool ifAnimation)
     if (ifAnimation) model_matrix = get_model_matrix(vertex);
     vertex.worldPos = Coord3D(Coord4D(vertex.worldPos, 1.f) * model_matrix);
 
-    vertex.worldPos = Coord3D(modelMat * Coord4D(vertex.worldPos, 1.f));
-    vertex.clipPos = projectionMat * viewMat * Coord4D(vertex.worldPos, 1.f);
-    vertex.normal = glm::mat3(glm::transpose(glm::inverse(modelMat))) * vertex.normal;
+    vertex.worldPos = Coord3D(uniform.modelMat * Coord4D(vertex.worldPos, 1.f));
+    vertex.clipPos = uniform.viewProjMat * Coord4D(vertex.worldPos, 1.f);
+    vertex.normal = uniform.normalMat * vertex.normal;
 }
 
 void BlinnPhongShader::fragmentShader(Fragment &fragment)
+{
+    fragment.fragmentColor = shade(fragment, uniform);
+}
+
+Color BlinnPhongShader::shade(const Fragment& fragment, const UniformBlock& block)
 {
     Color diffuseColor = {0.0f,0.0f,0.0f};
     Color specularColor = {0.0f,0.0f,0.0f};
-    if (material.diffuse.size() != 0) {
-        for (int i = 0; i < material.diffuse.size(); ++i)
-            diffuseColor += renderAPI::API().textureList[material.diffuse.at(i)].getColorFromUv(fragment.texUv);
-        diffuseColor /= material.diffuse.size();
+    if (block.diffuseCount != 0) {
+        for (int i = 0; i < block.diffuseCount; ++i)
+            diffuseColor += block.diffuse[i]->sample(fragment.texUv, fragment.texDx, fragment.texDy, block.filter);
+        diffuseColor /= block.diffuseCount;
     }
     else diffuseColor = { 0.6f,0.6f,0.6f };
-    if (material.specular.size() != 0) {
-        for (int i = 0; i < material.specular.size(); ++i)
-            specularColor = renderAPI::API().textureList[material.specular.at(i)].getColorFromUv(fragment.texUv);
-        specularColor /= material.specular.size();
+    if (block.specularCount != 0) {
+        for (int i = 0; i < block.specularCount; ++i)
+            specularColor = block.specular[i]->sample(fragment.texUv, fragment.texDx, fragment.texDy, block.filter);
+        specularColor /= block.specularCount;
     }
     else specularColor = { 1.0f,1.0f,1.0f };
     Vector3D normal = glm::normalize(fragment.normal);
-    Vector3D viewDir = glm::normalize(eyePos - fragment.worldPos);
+    Vector3D viewDir = glm::normalize(block.eyePos - fragment.worldPos);
     auto calculateLight = [&](Light light)->Color
     {
         Vector3D lightDir;
@@ -76,7 +82,7 @@ void BlinnPhongShader::fragmentShader(Fragment &fragment)
             lightDir = -Vector3D(light.dir);
         Color ambient = light.ambient * diffuseColor;
         Color diffuse = light.diffuse * std::max(glm::dot(normal,lightDir), 0.f) * diffuseColor;
-        Color specular = light.specular * std::pow(std::max(glm::dot(normal, glm::normalize(viewDir + lightDir)), 0.0f), material.shininess) * specularColor;
+        Color specular = light.specular * std::pow(std::max(glm::dot(normal, glm::normalize(viewDir + lightDir)), 0.0f), block.shininess) * specularColor;
         return (ambient + diffuse + specular);
     };
     Color result(0.f, 0.f, 0.f);
@@ -87,5 +93,136 @@ void BlinnPhongShader::fragmentShader(Fragment &fragment)
     if(result.x > 1.f) result.x = 1.f;
     if(result.y > 1.f) result.y = 1.f;
     if(result.z > 1.f) result.z = 1.f;
-    fragment.fragmentColor = result;
+    return result;
+}
+
+#ifdef __AVX2__
+// x^e for x in [0, 1] as exp2(e * log2(x)), both halves by short series, relative error within 1e-4
+static inline __m256 powUnit(__m256 x, float e)
+{
+    __m256i bits = _mm256_castps_si256(x);
+    __m256 k = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+    __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000)));
+    // log(m) = 2 * atanh(t), t = (m - 1) / (m + 1) stays below 1/3
+    __m256 one = _mm256_set1_ps(1.f);
+    __m256 t = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one));
+    __m256 t2 = _mm256_mul_ps(t, t);
+    __m256 series = _mm256_set1_ps(1.f / 11.f);
+    series = _mm256_fmadd_ps(series, t2, _mm256_set1_ps(1.f / 9.f));
+    series = _mm256_fmadd_ps(series, t2, _mm256_set1_ps(1.f / 7.f));
+    series = _mm256_fmadd_ps(series, t2, _mm256_set1_ps(1.f / 5.f));
+    series = _mm256_fmadd_ps(series, t2, _mm256_set1_ps(1.f / 3.f));
+    series = _mm256_fmadd_ps(series, t2, one);
+    __m256 log2x = _mm256_fmadd_ps(_mm256_mul_ps(t, series), _mm256_set1_ps(2.f / 0.69314718f), k);
+    __m256 y = _mm256_max_ps(_mm256_mul_ps(log2x, _mm256_set1_ps(e)), _mm256_set1_ps(-126.f));
+    // 2^y = 2^i * e^(f * ln2), f in [-0.5, 0.5]
+    __m256 i = _mm256_round_ps(y, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 f = _mm256_mul_ps(_mm256_sub_ps(y, i), _mm256_set1_ps(0.69314718f));
+    __m256 p = _mm256_set1_ps(1.f / 5040.f);
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.f / 720.f));
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.f / 120.f));
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.f / 24.f));
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.f / 6.f));
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(0.5f));
+    p = _mm256_fmadd_ps(p, f, one);
+    p = _mm256_fmadd_ps(p, f, one);
+    __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(i), _mm256_set1_epi32(127)), 23));
+    return _mm256_and_ps(_mm256_mul_ps(p, scale), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ));
+}
+
+static inline __m256 rsqrtExact(__m256 x)
+{
+    return _mm256_div_ps(_mm256_set1_ps(1.f), _mm256_sqrt_ps(x));
+}
+#endif
+
+// eight fragments per pass: textures are fetched per lane, the lighting runs in AVX2 registers
+void BlinnPhongShader::fragmentShader(FragmentBatch& batch, const UniformBlock& block)
+{
+#ifdef __AVX2__
+    alignas(32) float diffuseColor[3][FRAGMENT_BATCH] = {};
+    alignas(32) float specularColor[3][FRAGMENT_BATCH] = {};
+    for (int lane = 0; lane < batch.count; lane++)
+    {
+        Coord2D uv(batch.u[lane], batch.v[lane]);
+        Coord2D dx(batch.dudx[lane], batch.dvdx[lane]);
+        Coord2D dy(batch.dudy[lane], batch.dvdy[lane]);
+        Color diffuse = { 0.6f,0.6f,0.6f };
+        Color specular = { 1.0f,1.0f,1.0f };
+        if (block.diffuseCount != 0) {
+            diffuse = { 0.0f,0.0f,0.0f };
+            for (int i = 0; i < block.diffuseCount; ++i)
+                diffuse += block.diffuse[i]->sample(uv, dx, dy, block.filter);
+            diffuse /= block.diffuseCount;
+        }
+        if (block.specularCount != 0) {
+            for (int i = 0; i < block.specularCount; ++i)
+                specular = block.specular[i]->sample(uv, dx, dy, block.filter);
+            specular /= block.specularCount;
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            diffuseColor[c][lane] = diffuse[c];
+            specularColor[c][lane] = specular[c];
+        }
+    }
+    __m256 diffuse[3], specular[3], result[3];
+    for (int c = 0; c < 3; c++)
+    {
+        diffuse[c] = _mm256_load_ps(diffuseColor[c]);
+        specular[c] = _mm256_load_ps(specularColor[c]);
+        result[c] = _mm256_setzero_ps();
+    }
+    __m256 worldX = _mm256_load_ps(batch.worldX);
+    __m256 worldY = _mm256_load_ps(batch.worldY);
+    __m256 worldZ = _mm256_load_ps(batch.worldZ);
+    __m256 nx = _mm256_load_ps(batch.normalX);
+    __m256 ny = _mm256_load_ps(batch.normalY);
+    __m256 nz = _mm256_load_ps(batch.normalZ);
+    __m256 len = rsqrtExact(_mm256_fmadd_ps(nx, nx, _mm256_fmadd_ps(ny, ny, _mm256_mul_ps(nz, nz))));
+    nx = _mm256_mul_ps(nx, len); ny = _mm256_mul_ps(ny, len); nz = _mm256_mul_ps(nz, len);
+    __m256 vx = _mm256_sub_ps(_mm256_set1_ps(block.eyePos.x), worldX);
+    __m256 vy = _mm256_sub_ps(_mm256_set1_ps(block.eyePos.y), worldY);
+    __m256 vz = _mm256_sub_ps(_mm256_set1_ps(block.eyePos.z), worldZ);
+    len = rsqrtExact(_mm256_fmadd_ps(vx, vx, _mm256_fmadd_ps(vy, vy, _mm256_mul_ps(vz, vz))));
+    vx = _mm256_mul_ps(vx, len); vy = _mm256_mul_ps(vy, len); vz = _mm256_mul_ps(vz, len);
+    const __m256 zero = _mm256_setzero_ps();
+    for (const Light& light : lightList)
+    {
+        __m256 lx, ly, lz;
+        if (light.pos.w != 0.f)
+        {
+            lx = _mm256_sub_ps(_mm256_set1_ps(light.pos.x), worldX);
+            ly = _mm256_sub_ps(_mm256_set1_ps(light.pos.y), worldY);
+            lz = _mm256_sub_ps(_mm256_set1_ps(light.pos.z), worldZ);
+            len = rsqrtExact(_mm256_fmadd_ps(lx, lx, _mm256_fmadd_ps(ly, ly, _mm256_mul_ps(lz, lz))));
+            lx = _mm256_mul_ps(lx, len); ly = _mm256_mul_ps(ly, len); lz = _mm256_mul_ps(lz, len);
+        }
+        else
+        {
+            lx = _mm256_set1_ps(-light.dir.x);
+            ly = _mm256_set1_ps(-light.dir.y);
+            lz = _mm256_set1_ps(-light.dir.z);
+        }
+        __m256 diff = _mm256_max_ps(_mm256_fmadd_ps(nx, lx, _mm256_fmadd_ps(ny, ly, _mm256_mul_ps(nz, lz))), zero);
+        __m256 hx = _mm256_add_ps(vx, lx);
+        __m256 hy = _mm256_add_ps(vy, ly);
+        __m256 hz = _mm256_add_ps(vz, lz);
+        len = rsqrtExact(_mm256_fmadd_ps(hx, hx, _mm256_fmadd_ps(hy, hy, _mm256_mul_ps(hz, hz))));
+        __m256 spec = _mm256_mul_ps(_mm256_fmadd_ps(nx, hx, _mm256_fmadd_ps(ny, hy, _mm256_mul_ps(nz, hz))), len);
+        spec = powUnit(_mm256_min_ps(_mm256_max_ps(spec, zero), _mm256_set1_ps(1.f)), block.shininess);
+        for (int c = 0; c < 3; c++)
+        {
+            __m256 lit = _mm256_fmadd_ps(_mm256_set1_ps(light.diffuse[c]), diff, _mm256_set1_ps(light.ambient[c]));
+            result[c] = _mm256_fmadd_ps(lit, diffuse[c], result[c]);
+            result[c] = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_set1_ps(light.specular[c]), spec), specular[c], result[c]);
+        }
+    }
+    _mm256_store_ps(batch.red, _mm256_min_ps(result[0], _mm256_set1_ps(1.f)));
+    _mm256_store_ps(batch.green, _mm256_min_ps(result[1], _mm256_set1_ps(1.f)));
+    _mm256_store_ps(batch.blue, _mm256_min_ps(result[2], _mm256_set1_ps(1.f)));
+#else
+    for (int lane = 0; lane < batch.count; lane++)
+        batch.setColor(lane, shade(batch.get(lane), block));
+#endif
 }
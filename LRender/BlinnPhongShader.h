@@ -1,12 +1,15 @@
 #pragma once
 
 #include "shader.h"
-#include "texture.h"
+#include "Texture.h"
 
-class BlinnPhongShader : public Shader
+class BlinnPhongShader final : public Shader
 {
 public:
     virtual void vertexShader(Vertex &vertex, bool ifAnimation) override;
     virtual void fragmentShader(Fragment& fragment) override;
+    virtual void fragmentShader(FragmentBatch& batch, const UniformBlock& block) override;
     glm::mat4 get_model_matrix(Vertex vertex);
+private:
+    Color shade(const Fragment& fragment, const UniformBlock& block);
 };
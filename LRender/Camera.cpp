@@ -1,4 +1,4 @@
-#include "camera.h"
+#include "Camera.h"
 #include <QDebug>
 
 void Camera::rotateAroundTarget(Vector2D motion)
@@ -3,7 +3,9 @@
 
 #include <cmath>
 #include "lrenderBasicCore.h"
+#ifdef _MSC_VER
 #include "corecrt_math_defines.h"
+#endif
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 
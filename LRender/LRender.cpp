@@ -42,6 +42,27 @@ void LRender::setOption(Option option, bool val)
         ui->actionRayTracing->setChecked(val);
         ui->RenderWidget->setRayTracing(val);
     }
+    else if (option == DYNAMICRESOLUTION)
+    {
+        ui->actionDynamicResolution->setChecked(val);
+        ui->RenderWidget->setDynamicResolution(val);
+    }
+    else if (option == TIMING)
+    {
+        ui->actionTiming->setChecked(val);
+        ui->RenderWidget->setTimingOverlay(val);
+    }
+    else if (option == COMPRESSEDTEXTURES)
+    {
+        // takes effect with the next loaded model
+        ui->actionCompressedTextures->setChecked(val);
+        TextureCache::instance().setLayout(val ? LAYOUT_BC1 : LAYOUT_TILED);
+    }
+    else if (option == DEFERREDSHADING)
+    {
+        ui->actionDeferredShading->setChecked(val);
+        ui->RenderWidget->setDeferredShading(val);
+    }
 }
 void LRender::setLightColor(lightColorType type, QColor color)
 {
@@ -69,13 +90,12 @@ void LRender::setCameraPara(cameraPara para, float val)
     if (para == FOV)
     {
         ui->FovLabel->setText(QString::number(static_cast<int>(val)));
-        ui->RenderWidget->camera.fov = val;
     }
     else
     {
         ui->NearLabel->setText(QString::number(val, 'f', 1));
-        ui->RenderWidget->camera.zNear = val;
     }
+    ui->RenderWidget->setCameraPara(para, val);
 }
 void LRender::setLightDir()
 {
@@ -122,8 +142,12 @@ void LRender::initUI()
 #endif
     setOption(MUTITHREAD, true);
     setOption(FACECULLING, true);
+    setOption(DEFERREDSHADING, false);
     setOption(SKYBOX, false);
     setOption(RAYTRACING, false);
+    setOption(DYNAMICRESOLUTION, false);
+    setOption(TIMING, false);
+    setOption(COMPRESSEDTEXTURES, false);
     setCameraPara(FOV, 60.f);
     setCameraPara(NEAR, 1.0f);
     setLightColor(SPECULAR, QColor(255, 255, 255));
@@ -143,6 +167,11 @@ void LRender::initSignalAndSlot()
             ui->TriangleNumberLabel->setText(QString::number(triangleCount));
             ui->VertexNumberLabel->setText(QString::number(vertexCount));
         });
+    connect(ui->RenderWidget, &LRenderWidget::sendCullData, this,
+        [this](int culledCount)
+        {
+            ui->CulledNumberLabel->setText(QString::number(culledCount));
+        });
 }
 
 void LRender::on_LineCheckBox_clicked()
@@ -193,6 +222,33 @@ void LRender::on_actionRayTracing_triggered()
     setOption(RAYTRACING, ui->actionRayTracing->isChecked());
 }
 
+void LRender::on_actionDynamicResolution_triggered()
+{
+    setOption(DYNAMICRESOLUTION, ui->actionDynamicResolution->isChecked());
+}
+
+void LRender::on_actionTiming_triggered()
+{
+    setOption(TIMING, ui->actionTiming->isChecked());
+}
+
+void LRender::on_actionCompressedTextures_triggered()
+{
+    setOption(COMPRESSEDTEXTURES, ui->actionCompressedTextures->isChecked());
+}
+
+void LRender::on_actionDeferredShading_triggered()
+{
+    setOption(DEFERREDSHADING, ui->actionDeferredShading->isChecked());
+}
+
+void LRender::on_actionexport_timing_triggered()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, "Export Timing", "", "CSV(*.csv)");
+    if (!fileName.isEmpty() && !ui->RenderWidget->exportTiming(fileName))
+        QMessageBox::critical(this, "Error", "Timing export error!");
+}
+
 void LRender::on_FovSilder_valueChanged(int value)
 {
     setCameraPara(FOV, static_cast<float>(value));
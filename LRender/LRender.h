@@ -16,7 +16,7 @@ class LRender : public QMainWindow
 
 public:
 
-    enum Option { MUTITHREAD, FACECULLING, SKYBOX, RAYTRACING };
+    enum Option { MUTITHREAD, FACECULLING, SKYBOX, RAYTRACING, DYNAMICRESOLUTION, TIMING, COMPRESSEDTEXTURES, DEFERREDSHADING };
     explicit LRender(QWidget *parent = nullptr);
     ~LRender();
     void setOption(Option option, bool val);
@@ -40,6 +40,16 @@ private slots:
 
     void on_actionRayTracing_triggered();
 
+    void on_actionDynamicResolution_triggered();
+
+    void on_actionTiming_triggered();
+
+    void on_actionCompressedTextures_triggered();
+
+    void on_actionDeferredShading_triggered();
+
+    void on_actionexport_timing_triggered();
+
     void on_FovSilder_valueChanged(int value);
 
     void on_NearSilder_valueChanged(int value);
@@ -5,6 +5,8 @@
 
 int lastFrameTime;
 int deltaTime;
+// mouse state is written by the gui thread and sampled by the render thread
+std::mutex inputMutex;
 QPoint lastPos;
 QPoint currentPos;
 int ratio;
@@ -14,28 +16,48 @@ glm::mat4 modelMatrix;
 LRenderWidget::LRenderWidget(QWidget *parent) :
     QWidget(parent),camera((float)DEFAULT_WIDTH/DEFAULT_HEIGHT, FIXED_CAMERA_FAR),
     skyBoxCamera((float)DEFAULT_WIDTH / DEFAULT_HEIGHT, FIXED_CAMERA_FAR),
-    scWidth(DEFAULT_WIDTH), scHeight(DEFAULT_HEIGHT), ui(new Ui::LRenderWidget), model(nullptr)
+    scWidth(DEFAULT_WIDTH), scHeight(DEFAULT_HEIGHT), frameQueue(DEFAULT_WIDTH, DEFAULT_HEIGHT),
+    ui(new Ui::LRenderWidget), model(nullptr)
 {
     ui->setupUi(this);
     setFixedSize(scWidth, scHeight);
     ui->FPSLabel->setStyleSheet("background:transparent");
     ui->FPSLabel->setVisible(false);
     initDevice();
-    // set render frequency
-    connect(&timer, &QTimer::timeout, this, &LRenderWidget::render);
-    timer.start(1);
+    // frames are produced on the render thread, the gui thread only presents them
+    connect(this, &LRenderWidget::frameReady, this, QOverload<>::of(&LRenderWidget::update), Qt::QueuedConnection);
+    running = true;
+    renderThread = std::thread(&LRenderWidget::renderLoop, this);
     this->grabKeyboard();
 }
 
 LRenderWidget::~LRenderWidget()
 {
+    running = false;
+    if (renderThread.joinable()) renderThread.join();
     delete ui;
     delete model;
 }
 
+void LRenderWidget::post(std::function<void()> task)
+{
+    std::lock_guard<std::mutex> lock(taskMutex);
+    pendingTasks.push_back(std::move(task));
+}
+
+void LRenderWidget::runPendingTasks()
+{
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(taskMutex);
+        tasks.swap(pendingTasks);
+    }
+    for (auto& task : tasks) task();
+}
+
+// runs on the render thread
 void LRenderWidget::resetCamera()
 {
-    ui->FPSLabel->setVisible(true);
     skyBoxCamera.setModel(Coord3D(0.0, 0.0, 0.0), 1.0);
     camera.setModel(model->modelCenter, model->getYRange());
     modelMatrix = glm::mat4(1.0f);
@@ -43,33 +65,64 @@ void LRenderWidget::resetCamera()
 
 void LRenderWidget::setFigureColor(Color color, renderFigure type)
 {
-    switch(type)
+    post([=]()
     {
-    case BACKGROUND:
-        renderAPI::API().backgroundColor = color;
-        break;
-    case LINE:
-        renderAPI::API().lineColor = color;
-        break;
-    case POINT:
-        renderAPI::API().pointColor = color;
-    }
+        switch(type)
+        {
+        case BACKGROUND:
+            renderAPI::API().backgroundColor = color;
+            break;
+        case LINE:
+            renderAPI::API().lineColor = color;
+            break;
+        case POINT:
+            renderAPI::API().pointColor = color;
+        }
+    });
 }
 
 void LRenderWidget::setLightColor(Color color, lightColorType type)
 {
-    switch(type)
+    post([=]()
     {
-    case DIFFUSE:
-        renderAPI::API().shader->lightList.at(0).diffuse = color;
-        break;
-    case SPECULAR:
-        renderAPI::API().shader->lightList.at(0).specular = color;
-        break;
-    case AMBIENT:
-        renderAPI::API().shader->lightList.at(0).ambient = color;
-        break;
-    }
+        switch(type)
+        {
+        case DIFFUSE:
+            renderAPI::API().shader->lightList.at(0).diffuse = color;
+            break;
+        case SPECULAR:
+            renderAPI::API().shader->lightList.at(0).specular = color;
+            break;
+        case AMBIENT:
+            renderAPI::API().shader->lightList.at(0).ambient = color;
+            break;
+        }
+    });
+}
+
+void LRenderWidget::setDynamicResolution(bool val)
+{
+    post([=]()
+    {
+        ifDynamicResolution = val;
+        resolutionScaler.reset();
+        setRenderScale(1.f);
+    });
+}
+
+// runs on the render thread, the aspect ratio is kept so the cameras need no change
+void LRenderWidget::setRenderScale(float scale)
+{
+    renderAPI::API().resize(static_cast<int>(scWidth * scale + 0.5f), static_cast<int>(scHeight * scale + 0.5f));
+}
+
+void LRenderWidget::setCameraPara(cameraPara para, float val)
+{
+    post([=]()
+    {
+        if (para == FOV) camera.fov = val;
+        else camera.zNear = val;
+    });
 }
 
 void LRenderWidget::loadModel(QStringList paths)
@@ -81,11 +134,16 @@ void LRenderWidget::loadModel(QStringList paths)
         delete newModel;
         return;
     }
-    if(model != nullptr)
-        delete model;
-    model = newModel;
-    emit sendModelData(model->faceNum, model->vertexNum);
-    resetCamera();
+    emit sendModelData(newModel->faceNum, newModel->vertexNum);
+    ui->FPSLabel->setVisible(true);
+    // the old model may still be drawn, it is swapped out between two frames
+    post([=]()
+    {
+        if(model != nullptr)
+            delete model;
+        model = newModel;
+        resetCamera();
+    });
 }
 
 void LRenderWidget::initDevice()
@@ -179,14 +237,48 @@ void LRenderWidget::loadSkyBox(std::string skyPath)
     }
 }
 
+// present the newest finished frame, the fps shown is the rate frames reach the screen
 void LRenderWidget::paintEvent(QPaintEvent *)
 {
+    ScopedTimer timer(STAGE_PRESENT);
+    if (frameQueue.acquire())
+    {
+        int nowTime = QTime::currentTime().msecsSinceStartOfDay();
+        if (lastPresentTime != 0 && nowTime > lastPresentTime)
+            ui->FPSLabel->setText(QStringLiteral("FPS : ") + QString::number(1000.0 / (nowTime - lastPresentTime), 'f', 0));
+        lastPresentTime = nowTime;
+    }
     QPainter painter(this);
-    painter.drawImage(0, 0, renderAPI::API().getBuffer());
+    const QImage& image = frameQueue.front();
+    if (image.width() == scWidth && image.height() == scHeight)
+    {
+        painter.drawImage(0, 0, image);
+    }
+    else
+    {
+        // reduced internal resolution, upscaled here at present
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.drawImage(QRect(0, 0, scWidth, scHeight), image);
+    }
+    if (ifShowTiming) drawTiming(painter);
+}
+
+// per stage breakdown under the fps label, averaged over the last 30 frames
+void LRenderWidget::drawTiming(QPainter& painter)
+{
+    FrameTiming timing = Profiler::instance().average(30);
+    QString text;
+    for (int s = 0; s < STAGE_COUNT; s++)
+        text += QString(Profiler::stageName(s)) + " : " + QString::number(timing.stages[s], 'f', 2) + " ms\n";
+    text += QStringLiteral("frame : ") + QString::number(timing.total, 'f', 2) + " ms";
+    painter.setPen(ui->FPSLabel->palette().color(QPalette::WindowText));
+    QRect area = ui->FPSLabel->geometry();
+    painter.drawText(QRect(area.right() - 200, area.bottom() + 5, 200, 200), Qt::AlignRight | Qt::AlignTop, text);
 }
 
 void LRenderWidget::mousePressEvent(QMouseEvent *event)
 {
+    std::lock_guard<std::mutex> lock(inputMutex);
     currentBtns = event->buttons();
     currentPos = event->pos();
     lastPos = {0,0};
@@ -194,11 +286,13 @@ void LRenderWidget::mousePressEvent(QMouseEvent *event)
 
 void LRenderWidget::mouseReleaseEvent(QMouseEvent *event)
 {
+    std::lock_guard<std::mutex> lock(inputMutex);
     currentBtns = event->buttons();
 }
 
 void LRenderWidget::mouseMoveEvent(QMouseEvent *event)
 {
+    std::lock_guard<std::mutex> lock(inputMutex);
     currentPos = event->pos();
 }
 
@@ -214,6 +308,7 @@ void LRenderWidget::wheelEvent(QWheelEvent *event)
         QPoint numSteps = numDegrees / 15;
         res = numSteps;
     }
+    std::lock_guard<std::mutex> lock(inputMutex);
     ratio += res.y();
 }
 
@@ -232,62 +327,103 @@ void LRenderWidget::keyPressEvent(QKeyEvent* event)
     camera.setPositon(updatePos);*/
 }
 
-void LRenderWidget::processInput()
+// the mouse state is copied under the lock, the cameras are only touched by the render thread.
+// returns true when the cameras moved
+bool LRenderWidget::processInput()
 {
-    if((currentBtns & Qt::LeftButton) || (currentBtns & Qt::MidButton))
+    bool moved = false;
+    QPoint pos, prevPos;
+    Qt::MouseButtons btns;
+    int wheel;
+    {
+        std::lock_guard<std::mutex> lock(inputMutex);
+        pos = currentPos;
+        prevPos = lastPos;
+        btns = currentBtns;
+        wheel = ratio;
+        if ((btns & Qt::LeftButton) || (btns & Qt::MidButton)) lastPos = currentPos;
+        ratio = 0;
+    }
+    if((btns & Qt::LeftButton) || (btns & Qt::MidButton))
     {
-        if(!lastPos.isNull())
+        if(!prevPos.isNull())
         {
-            Vector2D motion = {(float)(currentPos - lastPos).x(), (float)(currentPos - lastPos).y()};
+            Vector2D motion = {(float)(pos - prevPos).x(), (float)(pos - prevPos).y()};
             motion.x = (motion.x / scWidth);
             motion.y = (motion.y / scHeight);
-            if(currentBtns & Qt::LeftButton)
+            if(btns & Qt::LeftButton)
             {
                 camera.rotateAroundTarget(motion);
                 skyBoxCamera.rotateAroundTarget(motion);
             }
-            if(currentBtns & Qt::MidButton)
+            if(btns & Qt::MidButton)
             {
                 camera.moveTarget(motion);
             }
+            moved = pos != prevPos;
         }
-        lastPos = currentPos;
     }
-    if(ratio != 0)
+    if(wheel != 0)
     {
-        camera.closeToTarget(ratio);
-        ratio = 0;
+        camera.closeToTarget(wheel);
+        moved = true;
+    }
+    return moved;
+}
+
+void LRenderWidget::renderLoop()
+{
+    while (running)
+    {
+        runPendingTasks();
+        // nothing new to draw, idle like the former 1 ms timer
+        if (!render()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
 }
 
-void LRenderWidget::render()
+// draw one frame on the render thread and queue it for presentation, returns false when no frame was produced
+bool LRenderWidget::render()
 {
-    if (ifOpenRayTracing && rayTracingProcess > 1500.0) return;
+    if (ifOpenRayTracing && rayTracingProcess > 1500.0) return false;
+    renderAPI& api = renderAPI::API();
+    if (model == nullptr && idleSubmitted && idleColor == api.backgroundColor
+        && idleWidth == api.getWidth() && idleHeight == api.getHeight()) return false;
+    auto frameStart = std::chrono::steady_clock::now();
     renderAPI::API().clearBuffer();
     if (ifOpenRayTracing && rayTracingProcess >= 1000.0) {
         rayTracingProcess += 1e5;
-        cornellBoxScene = new CornellBoxScene(model, Color(9.f / 255.f, 12.f / 255.f, 25.f / 255.f), DEFAULT_WIDTH, DEFAULT_HEIGHT);
+        auto cornellBoxScene = std::make_unique<CornellBoxScene>(model, Color(9.f / 255.f, 12.f / 255.f, 25.f / 255.f), DEFAULT_WIDTH, DEFAULT_HEIGHT);
         cornellBoxScene->buildBVH();
         QTime tracingRenderTime; tracingRenderTime.start();
         cornellBoxScene->cornellBoxRender();
         double fixTime = tracingRenderTime.elapsed() / 1000.0 / 60.0;
         qDebug() << "\n" << "Ray Tracing Render Time: " << fixTime << "mins";
+        // the traced image is always full resolution
+        resolutionScaler.reset();
+        setRenderScale(1.f);
         renderAPI::API().clearBuffer();
         renderAPI::API().setFrame(cornellBoxScene->frame);
-        update();
-        cornellBoxScene->~CornellBoxScene();
-        return;
+        frameQueue.submit(renderAPI::API().getBuffer());
+        emit frameReady();
+        return true;
     }
     if (!ifOpenRayTracing) rayTracingProcess = 0.0;
-    if(model == nullptr) return;
-    int nowTime = QTime::currentTime().msecsSinceStartOfDay();
-    if(lastFrameTime != 0)
+    if(model == nullptr)
     {
-        deltaTime = nowTime - lastFrameTime;
-        ui->FPSLabel->setText(QStringLiteral("FPS : ") + QString::number(1000.0 / deltaTime, 'f', 0));
+        frameQueue.submit(api.getBuffer());
+        emit frameReady();
+        idleSubmitted = true;
+        idleColor = api.backgroundColor;
+        idleWidth = api.getWidth();
+        idleHeight = api.getHeight();
+        return false;
     }
+    idleSubmitted = false;
+    int nowTime = QTime::currentTime().msecsSinceStartOfDay();
+    if(lastFrameTime != 0) deltaTime = nowTime - lastFrameTime;
     lastFrameTime = nowTime;
-    processInput();
+    // camera input is sampled right before the matrices are taken
+    bool moved = processInput();
     
     // render skybox
     if (ifShowSkyBox) {
@@ -300,12 +436,27 @@ void LRenderWidget::render()
     }
 
     // render model
-    renderAPI::API().shader->modelMat = modelMatrix;
-    renderAPI::API().shader->viewMat = camera.getViewMatrix();
-    renderAPI::API().shader->projectionMat = camera.getProjectionMatrix();
-    renderAPI::API().shader->eyePos = camera.position;
-    renderAPI::API().shader->material.shininess = 150.f;
+    // derived uniforms are only rebuilt when these change
+    renderAPI::API().shader->setModelMat(modelMatrix);
+    renderAPI::API().shader->setViewMat(camera.getViewMatrix());
+    renderAPI::API().shader->setProjectionMat(camera.getProjectionMatrix());
+    renderAPI::API().shader->setEyePos(camera.position);
+    renderAPI::API().shader->setShininess(150.f);
     model->modelRender();
-    update();
+    {
+        ScopedTimer timer(STAGE_PRESENT);
+        frameQueue.submit(renderAPI::API().getBuffer());
+    }
+    emit frameReady();
+    // the label only needs a queued update when the count moves
+    int culledCount = static_cast<int>(renderAPI::API().getStatistics().culledCount);
+    if (culledCount != lastCulledCount) {
+        lastCulledCount = culledCount;
+        emit sendCullData(culledCount);
+    }
+    float frameTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+    Profiler::instance().endFrame(frameTime);
+    if (ifDynamicResolution) setRenderScale(resolutionScaler.update(frameTime, moved));
     if (rayTracingProcess < 1000.0) rayTracingProcess += deltaTime;
+    return true;
 }
@@ -19,12 +19,18 @@
 #include <QKeyEvent>
 #include <QMessageBox>
 #include <QFileDialog>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
 #include "renderAPI.h"
-#include "blinnPhongShader.h"
+#include "BlinnPhongShader.h"
 #include "skyBoxShader.h"
 #include "cornellBoxScene.h"
-#include "model.h"
-#include "camera.h"
+#include "Model.h"
+#include "Camera.h"
+#include "frameQueue.h"
+#include "resolutionScaler.h"
 
 #define DEFAULT_WIDTH 1280
 #define DEFAULT_HEIGHT 960
@@ -41,15 +47,21 @@ class LRenderWidget : public QWidget
 public:
     explicit LRenderWidget(QWidget *parent = nullptr);
     ~LRenderWidget();
+    // render state belongs to the render thread, changes from the gui are applied before its next frame
     void setFigureColor(Color color, renderFigure type);
     void setLightColor(Color color, lightColorType type);
-    void setLightDir(Vector4D dir){renderAPI::API().shader->lightList.at(0).dir = dir;}
-    void setRenderMode(renderMode mode){renderAPI::API().renderMode = mode;}
-    void setFaceCulling(bool val) {renderAPI::API().faceCulling = val;}
-    void setMultiThread(bool val) { renderAPI::API().multiThread = val; }
-    void setSkyBox(bool val) { ifShowSkyBox = val; }
-    void setRayTracing(bool val) { ifOpenRayTracing = val; }
-    void saveImage(QString path){renderAPI::API().saveImage(path);}
+    void setLightDir(Vector4D dir){ post([=]() { renderAPI::API().shader->lightList.at(0).dir = dir; }); }
+    void setRenderMode(renderMode mode){ post([=]() { renderAPI::API().renderMode = mode; }); }
+    void setFaceCulling(bool val) { post([=]() { renderAPI::API().faceCulling = val; }); }
+    void setMultiThread(bool val) { post([=]() { renderAPI::API().multiThread = val; }); }
+    void setDeferredShading(bool val) { post([=]() { renderAPI::API().deferredShading = val; }); }
+    void setSkyBox(bool val) { post([=]() { ifShowSkyBox = val; }); }
+    void setRayTracing(bool val) { post([=]() { ifOpenRayTracing = val; }); }
+    void setDynamicResolution(bool val);
+    void setTimingOverlay(bool val) { ifShowTiming = val; }
+    bool exportTiming(QString path) { return Profiler::instance().exportCsv(path.toStdString()); }
+    void setCameraPara(cameraPara para, float val);
+    void saveImage(QString path){ frameQueue.front().save(path); }
     void loadModel(QStringList paths);
     void initDevice();
     void switchLightMode(bool turnLight);
@@ -65,23 +77,45 @@ protected:
     void keyPressEvent(QKeyEvent* event) Q_DECL_OVERRIDE;
 signals:
     void sendModelData(int triangleCount, int vertexCount);
-public slots:
-    void render();
+    void sendCullData(int culledCount);
+    void frameReady();
 
 private:
     int scWidth;
     int scHeight;
-    QTimer timer;
-    void processInput();
+    FrameQueue frameQueue;
+    std::thread renderThread;
+    std::atomic<bool> running{ false };
+    std::mutex taskMutex;
+    std::vector<std::function<void()>> pendingTasks;
+    int lastPresentTime{ 0 };
+    // gui thread only
+    bool ifShowTiming = false;
+    void drawTiming(QPainter& painter);
+    void post(std::function<void()> task);
+    void runPendingTasks();
+    void renderLoop();
+    bool render();
+    bool processInput();
     void resetCamera();
     Ui::LRenderWidget *ui;
     Model* model;
-    CornellBoxScene* cornellBoxScene;
     std::vector<Texture> skyBoxTexture;
     std::vector<Triangle> skyBoxModel;
     bool ifShowSkyBox = false;
     bool ifOpenRayTracing = false;
     double rayTracingProcess = 0.0;
+    // last empty frame queued without a model, it is only queued again when the clear changes
+    bool idleSubmitted = false;
+    Color idleColor;
+    int idleWidth = 0;
+    int idleHeight = 0;
+    // last count sent to the culled label
+    int lastCulledCount = -1;
+    // internal resolution follows the frame time while the camera moves
+    bool ifDynamicResolution = false;
+    ResolutionScaler resolutionScaler;
+    void setRenderScale(float scale);
 };
 
 #endif // LRENDERWIDGET_H
@@ -1,4 +1,4 @@
-#include "model.h"
+#include "Model.h"
 #include <QDebug>
 
 Model::Model(QStringList paths)
@@ -23,8 +23,38 @@ Model::Model(QStringList paths)
 
 void Model::modelRender()
 {
-    if (ifModelAnimation) updateModelSkeleton((float)fTimeCounter.elapsed() / 1000.0);
-    for(int i = 0; i < meshes.size(); i++) meshes.at(i)->meshRender();
+    modelRender((float)fTimeCounter.elapsed() / 1000.0);
+}
+
+void Model::modelRender(float animationTime)
+{
+    if (ifModelAnimation)
+    {
+        ScopedTimer timer(STAGE_SKELETON);
+        updateModelSkeleton(animationTime);
+    }
+    // all meshes go through one submission
+    drawCalls.clear();
+    for(size_t i = 0; i < meshes.size(); i++) drawCalls.push_back(meshes.at(i)->drawCall());
+    renderAPI::API().render(drawCalls.data(), drawCalls.size());
+}
+
+void Model::captureFaces()
+{
+    drawCalls.clear();
+    for (size_t i = 0; i < meshes.size(); i++) {
+        sigMesh* mesh = meshes.at(i);
+        if (mesh->app_ani_faces.size() != mesh->faces.size()) mesh->app_ani_faces = mesh->faces;
+        DrawCall call = mesh->drawCall();
+        call.output = mesh->app_ani_faces.data();
+        drawCalls.push_back(call);
+    }
+    renderAPI::API().render(drawCalls.data(), drawCalls.size());
+}
+
+void Model::waitForTextures()
+{
+    for (size_t i = 0; i < meshes.size(); i++) meshes.at(i)->resolveTextures(true);
 }
 
 void Model::updateModelSkeleton(float ft)
@@ -42,6 +72,17 @@ void Model::loadModel(QStringList paths)
     QList<QString>::Iterator path = paths.begin(), itend = paths.end();
     std::vector<std::string> texPaths;
     getAllTypeFiles(folderPath, texPaths, "png");
+    // start every mesh texture decoding up front so it overlaps the geometry parsing below,
+    // the futures keep the decoded textures cached until the meshes have picked them up
+    std::vector<std::shared_future<TextureHandle>> prefetch;
+    for (auto& texPath : texPaths) {
+        if (texPath.find("diffuse") == std::string::npos && texPath.find("specular") == std::string::npos) continue;
+        for (auto& meshName : meshNames) {
+            if (texPath.find(meshName) == std::string::npos) continue;
+            prefetch.push_back(TextureCache::instance().loadAsync(texPath));
+            break;
+        }
+    }
     for (int i = 0; path != itend; path++, i++) {
         sigMesh* tempMesh = new sigMesh(*path, texPaths, meshNames.at(i));
         minX = std::min(minX, tempMesh->minX_sig); minY = std::min(minY, tempMesh->minY_sig); minZ = std::min(minZ, tempMesh->minZ_sig);
@@ -18,6 +18,12 @@ class Model
     public:
         Model(QStringList paths);
         void modelRender();
+        // animation time in seconds given by the caller instead of the wall clock
+        void modelRender(float animationTime);
+        // draw once more with output so every mesh holds its current transformed faces in app_ani_faces
+        void captureFaces();
+        // block until every mesh texture has finished decoding
+        void waitForTextures();
         Coord3D modelCenter;
         int faceNum{0};
         int vertexNum{0};
@@ -41,6 +47,7 @@ class Model
         QString directory;
         std::string folderPath;
         std::vector<std::string> meshNames;
+        std::vector<DrawCall> drawCalls;
         void loadModel(QStringList paths);
         void updateModelSkeleton(float ft);
 };
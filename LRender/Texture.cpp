@@ -1,26 +1,266 @@
-#include "texture.h"
+#include "Texture.h"
 #include <QDebug>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <tbb/parallel_for.h>
 
-bool Texture::getTexture(QString path)
+bool Texture::getTexture(QString path, TextureLayout layout)
 {
     this->path = path;
-    if(texture.load(path))
+    QImage image;
+    if(image.load(path)) return setImage(image, layout);
+    return false;
+}
+
+bool Texture::getTexture(const uchar* data, int size, QString path, TextureLayout layout)
+{
+    this->path = path;
+    QImage image;
+    if (image.loadFromData(data, size)) return setImage(image, layout);
+    return false;
+}
+
+bool Texture::setImage(QImage& image, TextureLayout layout)
+{
+    // one conversion at load, sampling then reads a packed texel without going through QImage
+    image = image.mirrored().convertToFormat(QImage::Format_ARGB32);
+    imgWidth = image.width();
+    imgHeight = image.height();
+    texels = std::make_shared<std::vector<uint32_t, tbb::cache_aligned_allocator<uint32_t>>>(static_cast<size_t>(imgWidth) * imgHeight);
+    for (int y = 0; y < imgHeight; y++)
+        std::memcpy(texels->data() + static_cast<size_t>(y) * imgWidth, image.constScanLine(y), imgWidth * sizeof(uint32_t));
+    widthMask = (imgWidth & (imgWidth - 1)) == 0 ? imgWidth - 1 : -1;
+    heightMask = (imgHeight & (imgHeight - 1)) == 0 ? imgHeight - 1 : -1;
+    buildMipmaps();
+    this->layout = LAYOUT_LINEAR;
+    if (layout == LAYOUT_TILED) swizzle();
+    else if (layout == LAYOUT_BC1) compress();
+    texelData = texels->data();
+    return true;
+}
+
+// box filtered chain down to 1x1, odd sizes round down and the last row or column is clamped
+void Texture::buildMipmaps()
+{
+    levels.clear();
+    levels.push_back({ imgWidth, imgHeight, widthMask, heightMask, 0, 0 });
+    size_t total = static_cast<size_t>(imgWidth) * imgHeight;
+    while (levels.back().width > 1 || levels.back().height > 1)
     {
-        texture = texture.mirrored();
-        imgWidth = texture.width();
-        imgHeight = texture.height();
-        return true;
+        const MipLevel& prev = levels.back();
+        int w = std::max(1, prev.width / 2);
+        int h = std::max(1, prev.height / 2);
+        levels.push_back({ w, h, (w & (w - 1)) == 0 ? w - 1 : -1, (h & (h - 1)) == 0 ? h - 1 : -1, total, 0 });
+        total += static_cast<size_t>(w) * h;
+    }
+    texels->resize(total);
+    for (size_t l = 1; l < levels.size(); l++)
+    {
+        const MipLevel& src = levels[l - 1];
+        const MipLevel& dst = levels[l];
+        const uint32_t* from = texels->data() + src.offset;
+        uint32_t* to = texels->data() + dst.offset;
+        for (int y = 0; y < dst.height; y++)
+        {
+            int y0 = std::min(y * 2, src.height - 1), y1 = std::min(y * 2 + 1, src.height - 1);
+            for (int x = 0; x < dst.width; x++)
+            {
+                int x0 = std::min(x * 2, src.width - 1), x1 = std::min(x * 2 + 1, src.width - 1);
+                uint32_t quad[4] = { from[y0 * src.width + x0], from[y0 * src.width + x1], from[y1 * src.width + x0], from[y1 * src.width + x1] };
+                uint32_t result = 0;
+                for (int shift = 0; shift < 32; shift += 8)
+                {
+                    uint32_t sum = 2;
+                    for (uint32_t texel : quad) sum += (texel >> shift) & 0xff;
+                    result |= (sum / 4) << shift;
+                }
+                to[y * dst.width + x] = result;
+            }
+        }
     }
-    return false;
 }
 
-Color Texture::getColorFromUv(Coord2D coord)
+// reorder the linear chain into 4x4 tiles, a bilinear footprint or a short diagonal walk then
+// mostly stays within one or two cache lines instead of touching a line per row
+void Texture::swizzle()
 {
-    int x = static_cast<int>(coord.x * imgWidth - 0.5f) % imgWidth;
-    int y = static_cast<int>(coord.y * imgHeight - 0.5f) % imgHeight;
-    x = x < 0 ? imgWidth + x : x;
-    y = y < 0 ? imgHeight + y : y;
-    return Color(texture.pixelColor(x, y).red() / 255.f, texture.pixelColor(x, y).green() / 255.f, texture.pixelColor(x, y).blue() / 255.f);
+    auto tiled = std::make_shared<std::vector<uint32_t, tbb::cache_aligned_allocator<uint32_t>>>();
+    std::vector<MipLevel> tiledLevels = levels;
+    size_t total = 0;
+    for (MipLevel& level : tiledLevels)
+    {
+        level.rowTiles = (level.width + TEXTURE_TILE - 1) / TEXTURE_TILE;
+        level.offset = total;
+        total += static_cast<size_t>(level.rowTiles) * ((level.height + TEXTURE_TILE - 1) / TEXTURE_TILE) * TEXTURE_TILE * TEXTURE_TILE;
+    }
+    tiled->resize(total, 0);
+    const uint32_t* linear = texels->data();
+    texelData = tiled->data();
+    layout = LAYOUT_TILED;
+    for (size_t l = 0; l < levels.size(); l++)
+    {
+        const MipLevel& src = levels[l];
+        const MipLevel& dst = tiledLevels[l];
+        uint32_t* to = tiled->data();
+        for (int y = 0; y < src.height; y++)
+            for (int x = 0; x < src.width; x++)
+                to[dst.offset + ((y / TEXTURE_TILE) * dst.rowTiles + x / TEXTURE_TILE) * (TEXTURE_TILE * TEXTURE_TILE)
+                    + (y % TEXTURE_TILE) * TEXTURE_TILE + x % TEXTURE_TILE] = linear[src.offset + y * src.width + x];
+    }
+    levels = tiledLevels;
+    texels = tiled;
+}
+
+// encode the linear chain once, an eighth of the packed size. blocks past the image edge repeat the last row and column
+void Texture::compress()
+{
+    auto blocks = std::make_shared<std::vector<uint32_t, tbb::cache_aligned_allocator<uint32_t>>>();
+    std::vector<MipLevel> blockLevels = levels;
+    size_t total = 0;
+    for (MipLevel& level : blockLevels)
+    {
+        level.rowTiles = (level.width + TEXTURE_TILE - 1) / TEXTURE_TILE;
+        level.offset = total;
+        total += static_cast<size_t>(level.rowTiles) * ((level.height + TEXTURE_TILE - 1) / TEXTURE_TILE) * BLOCK_WORDS;
+    }
+    blocks->resize(total, 0);
+    const uint32_t* linear = texels->data();
+    for (size_t l = 0; l < levels.size(); l++)
+    {
+        const MipLevel& src = levels[l];
+        const MipLevel& dst = blockLevels[l];
+        uint32_t* to = blocks->data() + dst.offset;
+        tbb::parallel_for(0, (src.height + TEXTURE_TILE - 1) / TEXTURE_TILE, [&](int by)
+            {
+                uint32_t pixels[TEXTURE_TILE * TEXTURE_TILE];
+                for (int bx = 0; bx < dst.rowTiles; bx++)
+                {
+                    for (int j = 0; j < TEXTURE_TILE; j++)
+                        for (int i = 0; i < TEXTURE_TILE; i++)
+                        {
+                            int x = std::min(bx * TEXTURE_TILE + i, src.width - 1), y = std::min(by * TEXTURE_TILE + j, src.height - 1);
+                            pixels[j * TEXTURE_TILE + i] = linear[src.offset + y * src.width + x];
+                        }
+                    encodeBlock(pixels, to + (by * dst.rowTiles + bx) * BLOCK_WORDS);
+                }
+            });
+    }
+    levels = blockLevels;
+    texels = blocks;
+    layout = LAYOUT_BC1;
+}
+
+// endpoints are the extremes of the block along its principal color axis, each texel then takes
+// the nearest of the four palette entries as the decoder reconstructs them
+void Texture::encodeBlock(const uint32_t* pixels, uint32_t* block)
+{
+    const int count = TEXTURE_TILE * TEXTURE_TILE;
+    float color[count][3];
+    float mean[3] = { 0.f, 0.f, 0.f };
+    for (int k = 0; k < count; k++)
+        for (int c = 0; c < 3; c++)
+        {
+            color[k][c] = static_cast<float>((pixels[k] >> (16 - 8 * c)) & 0xff);
+            mean[c] += color[k][c] / count;
+        }
+    float cov[3][3] = {};
+    for (int k = 0; k < count; k++)
+        for (int a = 0; a < 3; a++)
+            for (int b = 0; b < 3; b++)
+                cov[a][b] += (color[k][a] - mean[a]) * (color[k][b] - mean[b]);
+    // a few power iterations are enough to order the texels
+    float axis[3] = { 1.f, 1.f, 1.f };
+    for (int iter = 0; iter < 4; iter++)
+    {
+        float next[3];
+        for (int a = 0; a < 3; a++) next[a] = cov[a][0] * axis[0] + cov[a][1] * axis[1] + cov[a][2] * axis[2];
+        float length = std::max(std::max(std::fabs(next[0]), std::fabs(next[1])), std::fabs(next[2]));
+        if (length < 1e-6f) break;
+        for (int a = 0; a < 3; a++) axis[a] = next[a] / length;
+    }
+    int lowest = 0, highest = 0;
+    float minDot = 0.f, maxDot = 0.f;
+    for (int k = 0; k < count; k++)
+    {
+        float dot = color[k][0] * axis[0] + color[k][1] * axis[1] + color[k][2] * axis[2];
+        if (k == 0 || dot < minDot) { minDot = dot; lowest = k; }
+        if (k == 0 || dot > maxDot) { maxDot = dot; highest = k; }
+    }
+    auto to565 = [&](int k)
+    {
+        uint32_t r = (static_cast<uint32_t>(color[k][0]) * 31 + 127) / 255;
+        uint32_t g = (static_cast<uint32_t>(color[k][1]) * 63 + 127) / 255;
+        uint32_t b = (static_cast<uint32_t>(color[k][2]) * 31 + 127) / 255;
+        return r << 11 | g << 5 | b;
+    };
+    uint32_t c0 = to565(highest), c1 = to565(lowest);
+    // the four color mode needs color0 > color1, equal endpoints leave every index at 0
+    if (c0 < c1) std::swap(c0, c1);
+    block[0] = c0 | c1 << 16;
+    block[1] = 0;
+    if (c0 == c1) return;
+    uint32_t palette[4];
+    decodePalette(block[0], palette);
+    for (int k = 0; k < count; k++)
+    {
+        uint32_t best = 0;
+        float bestError = 0.f;
+        for (uint32_t index = 0; index < 4; index++)
+        {
+            float error = 0.f;
+            for (int c = 0; c < 3; c++)
+            {
+                float d = color[k][c] - static_cast<float>((palette[index] >> (16 - 8 * c)) & 0xff);
+                error += d * d;
+            }
+            if (index == 0 || error < bestError) { bestError = error; best = index; }
+        }
+        block[1] |= best << (k * 2);
+    }
+}
+
+Color Texture::pointSample(const MipLevel& level, Coord2D coord) const
+{
+    int x = wrap(static_cast<int>(coord.x * level.width - 0.5f), level.width, level.widthMask);
+    int y = wrap(static_cast<int>(coord.y * level.height - 0.5f), level.height, level.heightMask);
+    return unpack(texelAt(level, x, y));
+}
+
+Color Texture::bilinearSample(const MipLevel& level, Coord2D coord) const
+{
+    float fx = coord.x * level.width - 0.5f;
+    float fy = coord.y * level.height - 0.5f;
+    float x0f = std::floor(fx), y0f = std::floor(fy);
+    float tx = fx - x0f, ty = fy - y0f;
+    int x0 = wrap(static_cast<int>(x0f), level.width, level.widthMask);
+    int x1 = wrap(static_cast<int>(x0f) + 1, level.width, level.widthMask);
+    int y0 = wrap(static_cast<int>(y0f), level.height, level.heightMask);
+    int y1 = wrap(static_cast<int>(y0f) + 1, level.height, level.heightMask);
+    // the four texels mostly share a bc1 block
+    BlockCache cache;
+    Color bottom = unpack(texelAt(level, x0, y0, cache)) * (1.f - tx) + unpack(texelAt(level, x1, y0, cache)) * tx;
+    Color top = unpack(texelAt(level, x0, y1, cache)) * (1.f - tx) + unpack(texelAt(level, x1, y1, cache)) * tx;
+    return bottom * (1.f - ty) + top * ty;
+}
+
+Color Texture::sample(Coord2D coord, Coord2D dx, Coord2D dy, TextureFilter filter) const
+{
+    // footprint of one pixel in level 0 texels, the longer screen axis decides
+    float lengthX = (dx.x * imgWidth) * (dx.x * imgWidth) + (dx.y * imgHeight) * (dx.y * imgHeight);
+    float lengthY = (dy.x * imgWidth) * (dy.x * imgWidth) + (dy.y * imgHeight) * (dy.y * imgHeight);
+    float lod = 0.5f * std::log2(std::max(std::max(lengthX, lengthY), 1.f));
+    lod = std::min(lod, static_cast<float>(levels.size() - 1));
+    if (filter == FILTER_TRILINEAR)
+    {
+        int base = static_cast<int>(lod);
+        float t = lod - base;
+        Color lower = bilinearSample(levels[base], coord);
+        if (t == 0.f || base + 1 >= static_cast<int>(levels.size())) return lower;
+        return lower * (1.f - t) + bilinearSample(levels[base + 1], coord) * t;
+    }
+    const MipLevel& level = levels[static_cast<int>(lod + 0.5f)];
+    return filter == FILTER_BILINEAR ? bilinearSample(level, coord) : pointSample(level, coord);
 }
 
 Vector3D Texture::reflect(const Vector3D& I, const Vector3D& N) const
@@ -2,18 +2,113 @@
 #define TEXTURE_H
 #include <QString>
 #include <QImage>
-#include <qDebug>
+#include <QDebug>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <tbb/cache_aligned_allocator.h>
+#ifdef _MSC_VER
 #include "corecrt_math_defines.h"
+#endif
 #include "lrenderBasicCore.h"
 
 enum TextureType { DIFFUSE_T, MICROFACET_T, MIRROR_T };
+// linear: scanline order, tiled: 4x4 texel tiles of one cache line each, in scanline order of tiles,
+// bc1: the same tiles compressed to 8 byte blocks of two rgb565 endpoints and 2 bit indices, alpha is dropped
+enum TextureLayout { LAYOUT_LINEAR, LAYOUT_TILED, LAYOUT_BC1 };
+
+#define TEXTURE_TILE 4
 
 class Texture
 {
 private:
     int imgWidth = 0;
     int imgHeight = 0;
-    QImage texture;
+    // texels decoded once at load as 0xAARRGGBB, rows bottom-up so v = 0 is the first row.
+    // the mip chain follows level 0 in the same array, shared between copies of the texture
+    std::shared_ptr<std::vector<uint32_t, tbb::cache_aligned_allocator<uint32_t>>> texels;
+    const uint32_t* texelData = nullptr;
+    // size - 1 for power of two sizes so wrapping is a mask, -1 otherwise
+    int widthMask = -1;
+    int heightMask = -1;
+    struct MipLevel
+    {
+        int width;
+        int height;
+        int widthMask;
+        int heightMask;
+        size_t offset;
+        // tiles per row of the tiled and bc1 layouts, a partial last tile is padded
+        int rowTiles;
+    };
+    // words per block of the bc1 layout, endpoints then indices
+    static constexpr int BLOCK_WORDS = 2;
+    std::vector<MipLevel> levels;
+    TextureLayout layout = LAYOUT_LINEAR;
+    // palette of the last bc1 block read, fetches that stay in the block skip its decode
+    struct BlockCache
+    {
+        const uint32_t* block = nullptr;
+        uint32_t palette[4];
+    };
+    // x and y are already wrapped
+    uint32_t texelAt(const MipLevel& level, int x, int y) const
+    {
+        BlockCache cache;
+        return texelAt(level, x, y, cache);
+    }
+    uint32_t texelAt(const MipLevel& level, int x, int y, BlockCache& cache) const
+    {
+        if (layout == LAYOUT_LINEAR) return texelData[level.offset + y * level.width + x];
+        if (layout == LAYOUT_BC1)
+        {
+            const uint32_t* block = texelData + level.offset + ((y / TEXTURE_TILE) * level.rowTiles + x / TEXTURE_TILE) * BLOCK_WORDS;
+            if (block != cache.block)
+            {
+                decodePalette(block[0], cache.palette);
+                cache.block = block;
+            }
+            return cache.palette[(block[1] >> (((y % TEXTURE_TILE) * TEXTURE_TILE + x % TEXTURE_TILE) * 2)) & 3];
+        }
+        return texelData[level.offset + ((y / TEXTURE_TILE) * level.rowTiles + x / TEXTURE_TILE) * (TEXTURE_TILE * TEXTURE_TILE)
+            + (y % TEXTURE_TILE) * TEXTURE_TILE + x % TEXTURE_TILE];
+    }
+    void swizzle();
+    void compress();
+    static uint32_t expand565(uint32_t c)
+    {
+        uint32_t r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+        return 0xff000000u | ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+    }
+    // the four colors of a block, 0 and 1 are the endpoints, 2 and 3 lie at a third and two thirds
+    static void decodePalette(uint32_t endpoints, uint32_t* palette)
+    {
+        uint32_t c0 = expand565(endpoints & 0xffff), c1 = expand565(endpoints >> 16);
+        palette[0] = c0;
+        palette[1] = c1;
+        palette[2] = palette[3] = 0xff000000u;
+        for (int shift = 0; shift < 24; shift += 8)
+        {
+            uint32_t a = (c0 >> shift) & 0xff, b = (c1 >> shift) & 0xff;
+            palette[2] |= ((a * 2 + b) / 3) << shift;
+            palette[3] |= ((a + b * 2) / 3) << shift;
+        }
+    }
+    static void encodeBlock(const uint32_t* pixels, uint32_t* block);
+    bool setImage(QImage& image, TextureLayout layout);
+    static int wrap(int i, int size, int mask)
+    {
+        if (mask >= 0) return i & mask;
+        i %= size;
+        return i < 0 ? i + size : i;
+    }
+    static Color unpack(uint32_t texel)
+    {
+        return Color(((texel >> 16) & 0xff) * (1.f / 255.f), ((texel >> 8) & 0xff) * (1.f / 255.f), (texel & 0xff) * (1.f / 255.f));
+    }
+    void buildMipmaps();
+    Color pointSample(const MipLevel& level, Coord2D coord) const;
+    Color bilinearSample(const MipLevel& level, Coord2D coord) const;
 
     // Compute reflection direction
     Vector3D reflect(const Vector3D& I, const Vector3D& N) const;
@@ -47,9 +142,25 @@ private:
 public:
     QString path;
     Texture(TextureType t = DIFFUSE_T, Vector3D e = Vector3D(0, 0, 0));
-    bool getTexture(QString path);
+    bool getTexture(QString path, TextureLayout layout = LAYOUT_TILED);
+    // decode an image already read into memory, path is only recorded
+    bool getTexture(const uchar* data, int size, QString path, TextureLayout layout = LAYOUT_TILED);
     bool haveUvImage() { return imgWidth != 0 && imgHeight != 0; };
-    Color getColorFromUv(Coord2D coord);
+    // nearest texel with repeat wrapping
+    Color getColorFromUv(Coord2D coord) const
+    {
+        int x = wrap(static_cast<int>(coord.x * imgWidth - 0.5f), imgWidth, widthMask);
+        int y = wrap(static_cast<int>(coord.y * imgHeight - 0.5f), imgHeight, heightMask);
+        return unpack(texelAt(levels[0], x, y));
+    }
+    // filtered sample, the level of detail comes from the screen space uv derivatives
+    Color sample(Coord2D coord, Coord2D dx, Coord2D dy, TextureFilter filter) const;
+    int mipCount() const { return static_cast<int>(levels.size()); }
+    TextureLayout getLayout() const { return layout; }
+    // resident size of the texel chain
+    size_t texelBytes() const { return texels ? texels->size() * sizeof(uint32_t) : 0; }
+    int getWidth() const { return imgWidth; }
+    int getHeight() const { return imgHeight; }
 
     TextureType m_type;
     //Vector3D m_color;
@@ -0,0 +1,11 @@
+#include <QCoreApplication>
+#include "benchmark.h"
+
+// standalone benchmark, linked against the render core only
+int main(int argc, char* argv[])
+{
+    QCoreApplication qtApp(argc, argv);
+    BenchmarkConfig config;
+    parseBenchmarkArgs(argc, argv, config);
+    return runBenchmark(config);
+}
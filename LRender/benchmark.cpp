@@ -0,0 +1,236 @@
+#include "benchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <QStringList>
+#include "renderAPI.h"
+#include "BlinnPhongShader.h"
+#include "skyBoxShader.h"
+#include "Model.h"
+#include "Camera.h"
+#include "profiler.h"
+
+void parseBenchmarkArgs(int argc, char* argv[], BenchmarkConfig& config)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--frames" && hasValue) config.frames = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--warmup" && hasValue) config.warmup = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--models" && hasValue) config.models = splitString(argv[++i], ",");
+        else if (arg == "--modes" && hasValue) config.modes = splitString(argv[++i], ",");
+        else if (arg == "--root" && hasValue) config.modelRoot = argv[++i];
+        else if (arg == "--out" && hasValue) config.output = argv[++i];
+        else if (arg == "--textures") config.textures = true;
+    }
+}
+
+static void writeResult(std::ostream& out, const BenchmarkResult& result)
+{
+    out << "{\"model\":\"" << result.model << "\",\"mode\":\"" << result.mode << "\""
+        << ",\"frames\":" << result.frames << ",\"triangles\":" << result.triangles
+        << ",\"min_ms\":" << result.minTime << ",\"median_ms\":" << result.medianTime << ",\"p99_ms\":" << result.p99Time
+        << ",\"triangles_per_s\":" << static_cast<long long>(result.trianglesPerSecond) << ",\"stages_ms\":{";
+    for (int s = 0; s < static_cast<int>(result.stageTimes.size()); s++)
+        out << (s ? "," : "") << '"' << Profiler::stageName(s) << "\":" << result.stageTimes[s];
+    out << "}}" << std::endl;
+}
+
+static bool setMode(const std::string& mode)
+{
+    renderAPI& api = renderAPI::API();
+    api.multiThread = true;
+    api.deferredShading = false;
+    if (mode == "tiled") { api.tiledRaster = true; api.atomicWrite = true; }
+    else if (mode == "deferred") { api.tiledRaster = true; api.atomicWrite = true; api.deferredShading = true; }
+    else if (mode == "atomic") { api.tiledRaster = false; api.atomicWrite = true; }
+    else if (mode == "racy") { api.tiledRaster = false; api.atomicWrite = false; }
+    else return false;
+    return true;
+}
+
+static BenchmarkResult runModel(const BenchmarkConfig& config, Model& model, const std::string& name, const std::string& mode)
+{
+    renderAPI& api = renderAPI::API();
+    Camera camera((float)config.width / config.height, 1000.f);
+    camera.setModel(model.modelCenter, model.getYRange());
+    std::vector<float> times;
+    times.reserve(config.frames);
+    long long triangles = 0;
+    // summed here, the profiler history is shorter than a long run
+    std::array<double, STAGE_COUNT> stageSums{};
+    for (int i = -config.warmup; i < config.frames; i++)
+    {
+        // one full turn around the model over the measured frames
+        camera.rotateAroundTarget(Vector2D(1.f / config.frames, 0.f));
+        auto start = std::chrono::steady_clock::now();
+        api.clearBuffer();
+        api.shader->setModelMat(glm::mat4(1.0f));
+        api.shader->setViewMat(camera.getViewMatrix());
+        api.shader->setProjectionMat(camera.getProjectionMatrix());
+        api.shader->setEyePos(camera.position);
+        api.shader->setShininess(150.f);
+        // animation steps with the frame index so every run poses the model the same way
+        model.modelRender((i + config.warmup) / 30.f);
+        float time = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        FrameTiming timing = Profiler::instance().endFrame(time);
+        if (i < 0) continue;
+        times.push_back(time);
+        for (int s = 0; s < STAGE_COUNT; s++) stageSums[s] += timing.stages[s];
+        triangles += api.getStatistics().faceCount;
+    }
+    BenchmarkResult result;
+    result.model = name;
+    result.mode = mode;
+    result.frames = config.frames;
+    result.triangles = triangles / config.frames;
+    for (double sum : stageSums) result.stageTimes.push_back(static_cast<float>(sum / config.frames));
+    double total = 0.0;
+    for (float t : times) total += t;
+    std::sort(times.begin(), times.end());
+    result.minTime = times.front();
+    result.medianTime = times[times.size() / 2];
+    result.p99Time = times[std::max(0, static_cast<int>(std::ceil(times.size() * 0.99)) - 1)];
+    result.trianglesPerSecond = total > 0.0 ? triangles / (total / 1000.0) : 0.0;
+    return result;
+}
+
+// walks a rotated grid of pixels in 8x8 blocks like the tile raster, one pixel per level 0 texel,
+// and samples it bilinear. returns ns per sample, the checksum keeps the loads from being dropped
+static double sampleTexture(const Texture& texture, int width, int height, float& checksum)
+{
+    const int size = 1024;
+    const float c = std::cos(0.5f), s = std::sin(0.5f);
+    Coord2D dx(c / width, s / height);
+    Coord2D dy(-s / width, c / height);
+    Color sum(0.f, 0.f, 0.f);
+    auto start = std::chrono::steady_clock::now();
+    for (int by = 0; by < size; by += 8)
+        for (int bx = 0; bx < size; bx += 8)
+            for (int y = by; y < by + 8; y++)
+                for (int x = bx; x < bx + 8; x++)
+                    sum += texture.sample(Coord2D(x * dx.x + y * dy.x, x * dx.y + y * dy.y), dx, dy, FILTER_BILINEAR);
+    double time = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    checksum += sum.x + sum.y + sum.z;
+    return time / (static_cast<double>(size) * size);
+}
+
+// root mean square error of level 0 against a reference, in 8 bit units
+static double textureError(const Texture& texture, const Texture& reference)
+{
+    double sum = 0.0;
+    int width = reference.getWidth(), height = reference.getHeight();
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+        {
+            Coord2D coord((x + 0.5f) / width, (y + 0.5f) / height);
+            Color d = (texture.getColorFromUv(coord) - reference.getColorFromUv(coord)) * 255.f;
+            sum += d.x * d.x + d.y * d.y + d.z * d.z;
+        }
+    return std::sqrt(sum / (3.0 * width * height));
+}
+
+static int runTextureBenchmark(const BenchmarkConfig& config, std::ostream& out)
+{
+    int failures = 0;
+    for (const std::string& name : config.models)
+    {
+        std::vector<std::string> images;
+        getAllTypeFiles(config.modelRoot + "/" + name, images, "png");
+        for (const std::string& image : images)
+        {
+            std::string lower = image;
+            std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+            if (lower.find("diffuse") == std::string::npos) continue;
+            Texture reference;
+            if (!reference.getTexture(QString::fromStdString(image), LAYOUT_LINEAR))
+            {
+                std::cerr << "cannot load " << image << std::endl;
+                failures++;
+                continue;
+            }
+            const std::pair<TextureLayout, const char*> layouts[] = { { LAYOUT_LINEAR, "linear" }, { LAYOUT_TILED, "tiled" }, { LAYOUT_BC1, "bc1" } };
+            for (const auto& layout : layouts)
+            {
+                Texture texture;
+                if (!texture.getTexture(QString::fromStdString(image), layout.first))
+                {
+                    std::cerr << "cannot load " << image << std::endl;
+                    failures++;
+                    break;
+                }
+                float checksum = 0.f;
+                // best of a few passes, the first one also warms the caches
+                double best = 0.0;
+                for (int pass = 0; pass < 5; pass++)
+                {
+                    double time = sampleTexture(texture, texture.getWidth(), texture.getHeight(), checksum);
+                    best = pass == 0 ? time : std::min(best, time);
+                }
+                out << "{\"texture\":\"" << image << "\",\"width\":" << texture.getWidth() << ",\"height\":" << texture.getHeight()
+                    << ",\"layout\":\"" << layout.second << "\",\"bytes\":" << texture.texelBytes() << ",\"rmse\":" << textureError(texture, reference)
+                    << ",\"ns_per_sample\":" << best << ",\"checksum\":" << checksum << "}" << std::endl;
+            }
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+int runBenchmark(const BenchmarkConfig& config)
+{
+    renderAPI::init(config.width, config.height);
+    renderAPI& api = renderAPI::API();
+    api.shader = std::make_unique<BlinnPhongShader>();
+    api.skyShader = std::make_unique<SkyBoxShader>();
+    api.shader->lightList.push_back(Light());
+
+    std::ofstream file;
+    if (!config.output.empty())
+    {
+        file.open(config.output);
+        if (!file)
+        {
+            std::cerr << "cannot open " << config.output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = config.output.empty() ? std::cout : file;
+    if (config.textures) return runTextureBenchmark(config, out);
+    int failures = 0;
+    for (const std::string& name : config.models)
+    {
+        std::vector<std::string> objFiles;
+        getAllTypeFiles(config.modelRoot + "/" + name, objFiles, "obj");
+        QStringList paths;
+        for (const std::string& obj : objFiles) paths.push_back(QString::fromStdString(obj));
+        if (paths.isEmpty())
+        {
+            std::cerr << "no obj files for " << name << std::endl;
+            failures++;
+            continue;
+        }
+        Model model(paths);
+        if (!model.loadSuccess)
+        {
+            std::cerr << "cannot load " << name << std::endl;
+            failures++;
+            continue;
+        }
+        // frames are only comparable once they are all drawn with the textures
+        model.waitForTextures();
+        for (const std::string& mode : config.modes)
+        {
+            if (!setMode(mode))
+            {
+                std::cerr << "unknown mode " << mode << std::endl;
+                failures++;
+                continue;
+            }
+            writeResult(out, runModel(config, model, name, mode));
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
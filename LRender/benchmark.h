@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// headless benchmark, only the render core is used so it runs without creating any widget
+struct BenchmarkConfig
+{
+    std::string modelRoot = "model";
+    std::vector<std::string> models = { "bunny", "spot", "crate", "diablo3", "azura", "nanosuit", "assassin", "phoenix" };
+    // tiled: sort-middle raster, deferred: tiled with visibility buffer shading, atomic: untiled with packed depth/color writes, racy: untiled plain writes
+    std::vector<std::string> modes = { "tiled", "deferred", "atomic", "racy" };
+    int frames = 300;
+    int warmup = 10;
+    int width = 1280;
+    int height = 960;
+    std::string output;
+    // sample the diffuse maps with each texel layout instead of rendering the models
+    bool textures = false;
+};
+
+struct BenchmarkResult
+{
+    std::string model;
+    std::string mode;
+    int frames = 0;
+    long long triangles = 0;
+    float minTime = 0.f;
+    float medianTime = 0.f;
+    float p99Time = 0.f;
+    double trianglesPerSecond = 0.0;
+    std::vector<float> stageTimes;
+};
+
+// parse "[--frames N] [--warmup N] [--models a,b] [--modes tiled,deferred,atomic,racy] [--root dir] [--out file] [--textures]"
+void parseBenchmarkArgs(int argc, char* argv[], BenchmarkConfig& config);
+// replays a fixed orbit around every model and writes one json object per model and mode,
+// to the output file or stdout. returns the process exit code
+int runBenchmark(const BenchmarkConfig& config);
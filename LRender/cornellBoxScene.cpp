@@ -41,7 +41,9 @@ CornellBoxScene::CornellBoxScene(Model* input_model, Color bkColor, int wid_p, i
     moveVec -= Vector3D(0.0, (cornellSceneModel->getYRange() - (input_model->getYRange() * scaleNum)) * 0.5, -toIn);
     glm::mat4 rotateMat = glm::mat4(1.0f);
     rotateMat = glm::rotate(rotateMat, glm::radians(30.f), glm::vec3(0.0f, 1.0f, 0.0f));
+    input_model->captureFaces();
     for (auto& item : input_model->getMeshes()) {
+        item->resolveTextures(true);
         for (auto& tri : item->app_ani_faces) {
             tri.v0.worldPos -= input_model->modelCenter; tri.v1.worldPos -= input_model->modelCenter; tri.v2.worldPos -= input_model->modelCenter;
             tri.v0.worldPos *= scaleNum; tri.v1.worldPos *= scaleNum; tri.v2.worldPos *= scaleNum;
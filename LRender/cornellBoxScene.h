@@ -2,8 +2,8 @@
 #include <mutex>
 #include <thread>
 #include "triangle.h"
-#include "camera.h"
-#include "model.h"
+#include "Camera.h"
+#include "Model.h"
 #include "BVH.h"
 
 class CornellBoxScene {
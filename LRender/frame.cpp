@@ -1,36 +1,135 @@
 #include "frame.h"
 #include <iostream>
 #include <QDebug>
+#include <tbb/parallel_for.h>
 
-Frame::Frame(int _w, int _h):frameWidth(_w), frameHeight(_h), zBuffer(frameWidth * frameHeight),
-    colorBuffer(frameWidth, frameHeight, QImage::Format_RGB888)
+Frame::Frame(int _w, int _h):frameWidth(_w), frameHeight(_h),
+    blockCols((_w + BLOCK_SIZE - 1) / BLOCK_SIZE), blockRows((_h + BLOCK_SIZE - 1) / BLOCK_SIZE),
+    tileCols((_w + TILE_SIZE - 1) / TILE_SIZE), tileRows((_h + TILE_SIZE - 1) / TILE_SIZE),
+    zBuffer(frameWidth * frameHeight), blockDepth(blockCols * blockRows), tileDepth(tileCols * tileRows),
+    triangleIdBuffer(frameWidth * frameHeight, -1), barycentricBuffer(frameWidth * frameHeight),
+    colorBuffer(frameWidth * frameHeight, packColor(Color(0.f, 0.f, 0.f)))
 {
-    colorBuffer.fill(QColor(0.f,0.f,0.f));
     std::fill(zBuffer.begin(), zBuffer.end(), 1.f);
+    std::fill(blockDepth.begin(), blockDepth.end(), 1.f);
+    std::fill(tileDepth.begin(), tileDepth.end(), 1.f);
 }
 
-bool Frame::updateZbuffer(int x, int y, float z)
+// farthest depth over the tiles touched by the pixel rectangle
+float Frame::getMaxDepth(int xMin, int yMin, int xMax, int yMax)
 {
-    if(z < zBuffer[y * frameWidth + x])
+    float maxDepth = 0.f;
+    for (int ty = yMin / TILE_SIZE; ty <= yMax / TILE_SIZE; ty++)
+        for (int tx = xMin / TILE_SIZE; tx <= xMax / TILE_SIZE; tx++)
+            maxDepth = std::max(maxDepth, tileDepth[ty * tileCols + tx]);
+    return maxDepth;
+}
+
+// refresh the block containing pixel (x, y) after its depth values were lowered,
+// the owning tile is only rebuilt when that block was holding the tile maximum
+void Frame::updateHiZ(int x, int y)
+{
+    int bx = x / BLOCK_SIZE;
+    int by = y / BLOCK_SIZE;
+    float maxDepth = 0.f;
+    for (int py = by * BLOCK_SIZE; py < std::min((by + 1) * BLOCK_SIZE, frameHeight); py++)
+        for (int px = bx * BLOCK_SIZE; px < std::min((bx + 1) * BLOCK_SIZE, frameWidth); px++)
+            maxDepth = std::max(maxDepth, zBuffer[py * frameWidth + px]);
+    float oldDepth = blockDepth[by * blockCols + bx];
+    blockDepth[by * blockCols + bx] = maxDepth;
+    int tx = x / TILE_SIZE;
+    int ty = y / TILE_SIZE;
+    if (oldDepth < tileDepth[ty * tileCols + tx]) return;
+    const int blocksPerTile = TILE_SIZE / BLOCK_SIZE;
+    float tileMax = 0.f;
+    for (int j = ty * blocksPerTile; j < std::min((ty + 1) * blocksPerTile, blockRows); j++)
+        for (int i = tx * blocksPerTile; i < std::min((tx + 1) * blocksPerTile, blockCols); i++)
+            tileMax = std::max(tileMax, blockDepth[j * blockCols + i]);
+    tileDepth[ty * tileCols + tx] = tileMax;
+}
+
+void Frame::packBuffer()
+{
+    if (packedBuffer.size != zBuffer.size())
     {
-        zBuffer[y * frameWidth + x] = z;
-        return true;
+        packedBuffer.pixels.reset(new std::atomic<uint64_t>[zBuffer.size()]);
+        packedBuffer.size = zBuffer.size();
     }
-    return false;
+    tbb::parallel_for(0, frameHeight, [&](int y)
+    {
+        const uint32_t* colorRow = &colorBuffer[(frameHeight - 1 - y) * frameWidth];
+        for (int x = 0; x < frameWidth; x++)
+            packedPixel(x, y).store((static_cast<uint64_t>(orderedDepth(zBuffer[y * frameWidth + x])) << 32) | colorRow[x], std::memory_order_relaxed);
+    });
+}
+
+// unpacks one block row at a time so its block depths are taken while the rows are still in cache
+void Frame::unpackBuffer()
+{
+    tbb::parallel_for(0, blockRows, [&](int by)
+    {
+        int yEnd = std::min((by + 1) * BLOCK_SIZE, frameHeight);
+        for (int y = by * BLOCK_SIZE; y < yEnd; y++)
+        {
+            uint32_t* colorRow = &colorBuffer[(frameHeight - 1 - y) * frameWidth];
+            for (int x = 0; x < frameWidth; x++)
+            {
+                uint64_t pixel = packedPixel(x, y).load(std::memory_order_relaxed);
+                zBuffer[y * frameWidth + x] = depthFromOrdered(static_cast<uint32_t>(pixel >> 32));
+                colorRow[x] = static_cast<uint32_t>(pixel);
+            }
+        }
+        for (int bx = 0; bx < blockCols; bx++)
+        {
+            float maxDepth = 0.f;
+            for (int y = by * BLOCK_SIZE; y < yEnd; y++)
+                for (int x = bx * BLOCK_SIZE; x < std::min((bx + 1) * BLOCK_SIZE, frameWidth); x++)
+                    maxDepth = std::max(maxDepth, zBuffer[y * frameWidth + x]);
+            blockDepth[by * blockCols + bx] = maxDepth;
+        }
+    });
+    rebuildHiZ();
+}
+
+// tile maxima from the block depths
+void Frame::rebuildHiZ()
+{
+    const int blocksPerTile = TILE_SIZE / BLOCK_SIZE;
+    tbb::parallel_for(0, tileRows, [&](int ty)
+    {
+        for (int tx = 0; tx < tileCols; tx++)
+        {
+            float tileMax = 0.f;
+            for (int j = ty * blocksPerTile; j < std::min((ty + 1) * blocksPerTile, blockRows); j++)
+                for (int i = tx * blocksPerTile; i < std::min((tx + 1) * blocksPerTile, blockCols); i++)
+                    tileMax = std::max(tileMax, blockDepth[j * blockCols + i]);
+            tileDepth[ty * tileCols + tx] = tileMax;
+        }
+    });
+}
+
+void Frame::setVisibility(int x, int y, int triangleId, const Vector3D& baryPos)
+{
+    triangleIdBuffer[y * frameWidth + x] = triangleId;
+    barycentricBuffer[y * frameWidth + x] = Vector2D(baryPos.y, baryPos.z);
 }
 
-void Frame::setPixel(int x, int y, Color color)
+Vector3D Frame::getBarycentric(int x, int y)
 {
-    colorBuffer.setPixelColor(x, frameHeight - 1 - y, QColor(color.r * 255.f, color.g * 255.f, color.b * 255.f));
+    const Vector2D& baryPos = barycentricBuffer[y * frameWidth + x];
+    return Vector3D(1.f - baryPos.x - baryPos.y, baryPos.x, baryPos.y);
 }
 
 void Frame::clearBuffer(Color color)
 {
     std::fill(zBuffer.begin(), zBuffer.end(), 1.f);
-    colorBuffer.fill(QColor(color.x * 255.f, color.y * 255.f, color.z * 255.f));
+    std::fill(blockDepth.begin(), blockDepth.end(), 1.f);
+    std::fill(tileDepth.begin(), tileDepth.end(), 1.f);
+    std::fill(triangleIdBuffer.begin(), triangleIdBuffer.end(), -1);
+    std::fill(colorBuffer.begin(), colorBuffer.end(), packColor(color));
 }
 
 bool Frame::saveImage(QString filePath)
 {
-    return colorBuffer.save(filePath);
+    return getImage().save(filePath);
 }
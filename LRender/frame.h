@@ -2,22 +2,111 @@
 #include "lrenderBasicCore.h"
 #include <string>
 #include <cfloat>
+#include <cstring>
 #include <QImage>
 #include <QColor>
 #include <QString>
+#include <atomic>
+#include <memory>
+#include <tbb/cache_aligned_allocator.h>
+
+#define TILE_SIZE 64
+#define BLOCK_SIZE 8
 
 class Frame
 {
 public:
     Frame(int _w, int _h);
-    bool updateZbuffer(int x, int y, float z);
-    void setPixel(int x, int y, Color color);
+    bool updateZbuffer(int x, int y, float z)
+    {
+        if (z < zBuffer[y * frameWidth + x])
+        {
+            zBuffer[y * frameWidth + x] = z;
+            return true;
+        }
+        return false;
+    }
+    // rows are stored top-down as 0xffRRGGBB, so the buffer is presented without conversion or flip
+    void setPixel(int x, int y, Color color) { colorBuffer[(frameHeight - 1 - y) * frameWidth + x] = packColor(color); }
     bool saveImage(QString filePath);
     void clearBuffer(Color color);
-    QImage& getImage(){return colorBuffer;}
+    // wraps the color buffer without copying, valid until the frame is destroyed or reassigned
+    QImage getImage() { return QImage(reinterpret_cast<uchar*>(colorBuffer.data()), frameWidth, frameHeight, frameWidth * sizeof(uint32_t), QImage::Format_RGB32); }
+    static uint32_t packColor(Color color)
+    {
+        uint32_t r = static_cast<uint32_t>(std::min(std::max(color.r, 0.f), 1.f) * 255.f);
+        uint32_t g = static_cast<uint32_t>(std::min(std::max(color.g, 0.f), 1.f) * 255.f);
+        uint32_t b = static_cast<uint32_t>(std::min(std::max(color.b, 0.f), 1.f) * 255.f);
+        return 0xff000000u | (r << 16) | (g << 8) | b;
+    }
+    // hierarchical z, farthest depth of a BLOCK_SIZE block and of a TILE_SIZE tile
+    float getBlockDepth(int x, int y) { return blockDepth[(y / BLOCK_SIZE) * blockCols + x / BLOCK_SIZE]; }
+    float getMaxDepth(int xMin, int yMin, int xMax, int yMax);
+    void updateHiZ(int x, int y);
+    // visibility buffer, triangle id and barycentric of the nearest fragment for deferred shading
+    void setVisibility(int x, int y, int triangleId, const Vector3D& baryPos);
+    int getTriangleId(int x, int y) { return triangleIdBuffer[y * frameWidth + x]; }
+    Vector3D getBarycentric(int x, int y);
+    float getDepth(int x, int y) { return zBuffer[y * frameWidth + x]; }
+    void resetVisibility(int x, int y) { triangleIdBuffer[y * frameWidth + x] = -1; }
+    // packed 64-bit depth and color, the depth test and color write are one compare-and-swap,
+    // so racing threads never leave a pixel whose color does not belong to its depth
+    void packBuffer();
+    void unpackBuffer();
+    bool testPackedDepth(int x, int y, float z)
+    {
+        return orderedDepth(z) < static_cast<uint32_t>(packedPixel(x, y).load(std::memory_order_relaxed) >> 32);
+    }
+    bool writePacked(int x, int y, float z, Color color)
+    {
+        std::atomic<uint64_t>& pixel = packedPixel(x, y);
+        uint64_t desired = (static_cast<uint64_t>(orderedDepth(z)) << 32) | packColor(color);
+        uint64_t expected = pixel.load(std::memory_order_relaxed);
+        while (desired < expected)
+        {
+            if (pixel.compare_exchange_weak(expected, desired, std::memory_order_relaxed)) return true;
+        }
+        return false;
+    }
 private:
 	int frameWidth;
 	int frameHeight;
-    std::vector<float> zBuffer;
-    QImage colorBuffer;
+    int blockCols;
+    int blockRows;
+    int tileCols;
+    int tileRows;
+    std::vector<float, tbb::cache_aligned_allocator<float>> zBuffer;
+    std::vector<float> blockDepth;
+    std::vector<float> tileDepth;
+    std::vector<int> triangleIdBuffer;
+    std::vector<Vector2D> barycentricBuffer;
+    std::vector<uint32_t, tbb::cache_aligned_allocator<uint32_t>> colorBuffer;
+    // scratch of the packed write path, a copied frame starts without one
+    struct PackedBuffer
+    {
+        std::unique_ptr<std::atomic<uint64_t>[]> pixels;
+        size_t size = 0;
+        PackedBuffer() = default;
+        PackedBuffer(const PackedBuffer&) {}
+        PackedBuffer(PackedBuffer&&) = default;
+        PackedBuffer& operator=(const PackedBuffer&) { return *this; }
+        PackedBuffer& operator=(PackedBuffer&&) = default;
+    };
+    PackedBuffer packedBuffer;
+    std::atomic<uint64_t>& packedPixel(int x, int y) { return packedBuffer.pixels[y * frameWidth + x]; }
+    void rebuildHiZ();
+    // maps float depth to unsigned bits with the same ordering, negative values included
+    static uint32_t orderedDepth(float z)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &z, sizeof(bits));
+        return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+    }
+    static float depthFromOrdered(uint32_t bits)
+    {
+        bits = (bits & 0x80000000u) ? (bits & 0x7fffffffu) : ~bits;
+        float z;
+        std::memcpy(&z, &bits, sizeof(z));
+        return z;
+    }
 };
@@ -0,0 +1,31 @@
+#include "frameQueue.h"
+#include <cstring>
+
+FrameQueue::FrameQueue(int _w, int _h)
+{
+    for (QImage& buffer : buffers)
+    {
+        buffer = QImage(_w, _h, QImage::Format_RGB32);
+        buffer.fill(Qt::black);
+    }
+}
+
+void FrameQueue::submit(const QImage& image)
+{
+    QImage& back = buffers[backIndex];
+    if (back.size() != image.size() || back.format() != image.format()) back = image.copy();
+    else std::memcpy(back.bits(), image.constBits(), static_cast<size_t>(image.bytesPerLine()) * image.height());
+    // only the indices are swapped under the lock
+    std::lock_guard<std::mutex> lock(swapMutex);
+    std::swap(backIndex, readyIndex);
+    fresh = true;
+}
+
+bool FrameQueue::acquire()
+{
+    std::lock_guard<std::mutex> lock(swapMutex);
+    if (!fresh) return false;
+    std::swap(frontIndex, readyIndex);
+    fresh = false;
+    return true;
+}
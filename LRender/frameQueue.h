@@ -0,0 +1,25 @@
+#pragma once
+#include <array>
+#include <mutex>
+#include <QImage>
+
+// triple buffered hand over of finished frames from the render thread to the gui thread.
+// the render thread never waits for a paint and a paint always shows the newest finished frame
+class FrameQueue
+{
+public:
+    FrameQueue(int _w, int _h);
+    // render thread: copy a finished frame into the back buffer and publish it
+    void submit(const QImage& image);
+    // gui thread: move the newest published frame to the front, false when nothing arrived since the last call
+    bool acquire();
+    const QImage& front() const { return buffers[frontIndex]; }
+private:
+    std::array<QImage, 3> buffers;
+    // the back buffer belongs to the render thread, the front buffer to the gui thread
+    int frontIndex{ 0 };
+    int readyIndex{ 1 };
+    int backIndex{ 2 };
+    bool fresh{ false };
+    std::mutex swapMutex;
+};
@@ -7,6 +7,7 @@
 #include <string>
 #include <any>
 #include <cassert>
+#include <cfloat>
 #include <cmath>
 #include <random>
 #include <iostream>
@@ -73,6 +74,51 @@ struct Fragment
     Color fragmentColor = Color(0.0, 0.0, 0.0);
     Vector3D normal = Vector3D(0.0, 0.0, 0.0);
     Coord2D texUv = Coord2D(0.0, 0.0);
+    // screen space derivatives of texUv along x and y, they select the mip level
+    Coord2D texDx = Coord2D(0.0, 0.0);
+    Coord2D texDy = Coord2D(0.0, 0.0);
+};
+
+#define FRAGMENT_BATCH 8
+
+// structure of arrays of up to FRAGMENT_BATCH fragments, shaded together by the batched shader entry.
+// lanes below count are covered, the others hold stale but finite values and are ignored
+struct alignas(32) FragmentBatch
+{
+    float worldX[FRAGMENT_BATCH] = {};
+    float worldY[FRAGMENT_BATCH] = {};
+    float worldZ[FRAGMENT_BATCH] = {};
+    float normalX[FRAGMENT_BATCH] = {};
+    float normalY[FRAGMENT_BATCH] = {};
+    float normalZ[FRAGMENT_BATCH] = {};
+    float u[FRAGMENT_BATCH] = {};
+    float v[FRAGMENT_BATCH] = {};
+    float dudx[FRAGMENT_BATCH] = {};
+    float dvdx[FRAGMENT_BATCH] = {};
+    float dudy[FRAGMENT_BATCH] = {};
+    float dvdy[FRAGMENT_BATCH] = {};
+    float red[FRAGMENT_BATCH] = {};
+    float green[FRAGMENT_BATCH] = {};
+    float blue[FRAGMENT_BATCH] = {};
+    float zValue[FRAGMENT_BATCH] = {};
+    int x[FRAGMENT_BATCH] = {};
+    int y[FRAGMENT_BATCH] = {};
+    int count = 0;
+    bool full() const { return count == FRAGMENT_BATCH; }
+    Fragment get(int lane) const
+    {
+        Fragment frag;
+        frag.worldPos = Coord3D(worldX[lane], worldY[lane], worldZ[lane]);
+        frag.screenPos = CoordI2D(x[lane], y[lane]);
+        frag.zValue = zValue[lane];
+        frag.normal = Vector3D(normalX[lane], normalY[lane], normalZ[lane]);
+        frag.texUv = Coord2D(u[lane], v[lane]);
+        frag.texDx = Coord2D(dudx[lane], dvdx[lane]);
+        frag.texDy = Coord2D(dudy[lane], dvdy[lane]);
+        return frag;
+    }
+    Color getColor(int lane) const { return Color(red[lane], green[lane], blue[lane]); }
+    void setColor(int lane, const Color& color) { red[lane] = color.x; green[lane] = color.y; blue[lane] = color.z; }
 };
 
 struct Light
@@ -93,6 +139,29 @@ struct Material
     float shininess;
 };
 
+class Texture;
+
+// point: nearest texel of the nearest mip, bilinear: 2x2 texels of the nearest mip, trilinear: bilinear on the two nearest mips
+enum TextureFilter { FILTER_POINT, FILTER_BILINEAR, FILTER_TRILINEAR };
+
+#define MAX_BOUND_TEXTURES 8
+
+// flat per draw constants the shaders read, derived values are rebuilt by Shader::updateUniforms
+// only when the inputs they depend on were changed through the setters
+struct UniformBlock
+{
+    glm::mat4 modelMat = glm::mat4(1.f);
+    glm::mat4 viewProjMat = glm::mat4(1.f);
+    glm::mat3 normalMat = glm::mat3(1.f);
+    Coord3D eyePos = Coord3D(0.f, 0.f, 0.f);
+    float shininess = 0.f;
+    TextureFilter filter = FILTER_TRILINEAR;
+    int diffuseCount = 0;
+    int specularCount = 0;
+    const Texture* diffuse[MAX_BOUND_TEXTURES] = {};
+    const Texture* specular[MAX_BOUND_TEXTURES] = {};
+};
+
 inline float clamp(const float& lo, const float& hi, const float& v)
 {
     return std::max(lo, std::min(hi, v));
@@ -0,0 +1,77 @@
+#include "profiler.h"
+#include <fstream>
+#include <algorithm>
+
+const char* Profiler::stageName(int stage)
+{
+    static const char* names[STAGE_COUNT] = { "clear", "skeleton", "vertex", "clip", "raster", "fragment", "skybox", "present" };
+    return stage >= 0 && stage < STAGE_COUNT ? names[stage] : "unknown";
+}
+
+SampleRing* Profiler::threadRing()
+{
+    thread_local SampleRing* ring = nullptr;
+    if (ring == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        rings.push_back(std::make_unique<SampleRing>());
+        ring = rings.back().get();
+    }
+    return ring;
+}
+
+void Profiler::record(ProfileStage stage, float time)
+{
+    threadRing()->push({ stage, time });
+}
+
+FrameTiming Profiler::endFrame(float frameTime)
+{
+    FrameTiming timing;
+    timing.total = frameTime;
+    {
+        // registration is rare, the lock only guards the ring list
+        std::lock_guard<std::mutex> lock(ringMutex);
+        for (auto& ring : rings)
+            ring->drain([&](const StageSample& sample) { timing.stages[sample.stage] += sample.time; });
+    }
+    std::lock_guard<std::mutex> lock(historyMutex);
+    timing.frame = frameCount++;
+    history.push_back(timing);
+    if (history.size() > PROFILER_HISTORY) history.pop_front();
+    return timing;
+}
+
+FrameTiming Profiler::average(int frames)
+{
+    FrameTiming mean;
+    std::lock_guard<std::mutex> lock(historyMutex);
+    int count = std::min(frames, static_cast<int>(history.size()));
+    if (count == 0) return mean;
+    for (auto it = history.end() - count; it != history.end(); ++it)
+    {
+        mean.total += it->total;
+        for (int s = 0; s < STAGE_COUNT; s++) mean.stages[s] += it->stages[s];
+    }
+    mean.frame = history.back().frame;
+    mean.total /= count;
+    for (int s = 0; s < STAGE_COUNT; s++) mean.stages[s] /= count;
+    return mean;
+}
+
+bool Profiler::exportCsv(const std::string& path)
+{
+    std::ofstream file(path);
+    if (!file) return false;
+    file << "frame";
+    for (int s = 0; s < STAGE_COUNT; s++) file << ',' << stageName(s);
+    file << ",total\n";
+    std::lock_guard<std::mutex> lock(historyMutex);
+    for (const FrameTiming& timing : history)
+    {
+        file << timing.frame;
+        for (int s = 0; s < STAGE_COUNT; s++) file << ',' << timing.stages[s];
+        file << ',' << timing.total << '\n';
+    }
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// samples a thread can hold before the render thread collects them, later samples are dropped
+#define PROFILER_RING_SIZE 1024
+// frames of timing kept for the overlay and csv export
+#define PROFILER_HISTORY 1000
+
+// frame stages, vertex shading of non-indexed draws is part of clipping and in forward shading
+// (and on the untiled path) fragment shading is part of rasterization
+enum ProfileStage { STAGE_CLEAR, STAGE_SKELETON, STAGE_VERTEX, STAGE_CLIP, STAGE_RASTER, STAGE_FRAGMENT, STAGE_SKYBOX, STAGE_PRESENT, STAGE_COUNT };
+
+struct StageSample
+{
+    int stage;
+    float time;
+};
+
+// single producer single consumer queue, written by its own thread and drained by the render thread
+class SampleRing
+{
+public:
+    bool push(const StageSample& sample)
+    {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == PROFILER_RING_SIZE) return false;
+        samples[h % PROFILER_RING_SIZE] = sample;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+    template<class F>
+    void drain(F&& f)
+    {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        unsigned h = head.load(std::memory_order_acquire);
+        for (; t != h; t++) f(samples[t % PROFILER_RING_SIZE]);
+        tail.store(t, std::memory_order_release);
+    }
+private:
+    std::array<StageSample, PROFILER_RING_SIZE> samples;
+    std::atomic<unsigned> head{ 0 };
+    std::atomic<unsigned> tail{ 0 };
+};
+
+// stage times of one frame in ms, a stage timed on several threads is summed
+struct FrameTiming
+{
+    long long frame = 0;
+    float total = 0.f;
+    std::array<float, STAGE_COUNT> stages{};
+};
+
+class Profiler
+{
+public:
+    static Profiler& instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+    static const char* stageName(int stage);
+    // any thread, lock free once the thread has its ring
+    void record(ProfileStage stage, float time);
+    // render thread: collect the samples of all threads into the record of the frame just finished, which is returned
+    FrameTiming endFrame(float frameTime);
+    // mean over the last frames, for the overlay
+    FrameTiming average(int frames);
+    bool exportCsv(const std::string& path);
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+private:
+    Profiler() = default;
+    SampleRing* threadRing();
+    std::mutex ringMutex;
+    // rings outlive their threads, tbb workers and the gui thread register once
+    std::vector<std::unique_ptr<SampleRing>> rings;
+    std::mutex historyMutex;
+    std::deque<FrameTiming> history;
+    long long frameCount = 0;
+};
+
+// times its scope and records it under a stage
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(ProfileStage _stage) : stage(_stage), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer()
+    {
+        Profiler::instance().record(stage, std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+private:
+    ProfileStage stage;
+    std::chrono::steady_clock::time_point start;
+};
@@ -1,13 +1,123 @@
 ﻿#include "renderAPI.h"
+#include "BlinnPhongShader.h"
+#include <algorithm>
 #include <QDebug>
 #include <QTime>
 
 // renderAPI related function
-static inline bool isInTriangle(Vector3D bc_screen)
+// index of the lowest set bit, tzcnt would need bmi enabled under gcc and clang
+static inline int lowestBit(unsigned mask)
 {
-    bool flag = true;
-    if (bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0) flag = false;
-    return flag;
+#ifdef _MSC_VER
+    return static_cast<int>(_tzcnt_u32(mask));
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+static inline bool fitInt32Lanes(const TriangleSetup& setup, int xMin, int yMin, int xMax, int yMax)
+{
+    // edge functions are linear, so the extreme values are found on the bounding box corners
+    const long long limit = 1ll << 30;
+    for (int i = 0; i < 3; i++)
+    {
+        long long corner[4] = {
+            (long long)setup.a[i] * xMin + (long long)setup.b[i] * yMin + setup.c[i],
+            (long long)setup.a[i] * xMax + (long long)setup.b[i] * yMin + setup.c[i],
+            (long long)setup.a[i] * xMin + (long long)setup.b[i] * yMax + setup.c[i],
+            (long long)setup.a[i] * xMax + (long long)setup.b[i] * yMax + setup.c[i]};
+        for (int k = 0; k < 4; k++)
+            if (corner[k] >= limit || corner[k] <= -limit) return false;
+    }
+    return true;
+}
+
+// walk the box in row-major 8x8 blocks and call shade(x, y, barycentric) for every covered pixel,
+// blocks are classified first so fully covered ones skip the inside test and empty ones are skipped.
+// shade returns whether the depth was written; with a hiZ frame, blocks whose farthest depth is
+// nearer than minZ are rejected and the hierarchical z of written blocks is refreshed
+template<class F>
+static inline void traverseTriangle(const TriangleSetup& setup, int xMin, int yMin, int xMax, int yMax, float minZ, Frame* hiZ, F&& shade)
+{
+    if (setup.degenerate || xMin > xMax || yMin > yMax) return;
+    bool depthWritten = false;
+    auto emit = [&](int x, int y, long long w0, long long w1, long long w2)
+    {
+        Vector3D baryPos(w0 * setup.invArea, w1 * setup.invArea, w2 * setup.invArea);
+        if (shade(x, y, baryPos)) depthWritten = true;
+    };
+#ifdef __AVX2__
+    const bool simd = fitInt32Lanes(setup, xMin & ~(BLOCK_SIZE - 1), yMin & ~(BLOCK_SIZE - 1), xMax | (BLOCK_SIZE - 1), yMax | (BLOCK_SIZE - 1));
+    const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i stepA[3];
+    for (int i = 0; i < 3; i++) stepA[i] = _mm256_mullo_epi32(_mm256_set1_epi32(setup.a[i]), laneIndex);
+#endif
+    for (int by = yMin & ~(BLOCK_SIZE - 1); by <= yMax; by += BLOCK_SIZE)
+    {
+        for (int bx = xMin & ~(BLOCK_SIZE - 1); bx <= xMax; bx += BLOCK_SIZE)
+        {
+            int x0 = std::max(bx, xMin);
+            int y0 = std::max(by, yMin);
+            int x1 = std::min(bx + BLOCK_SIZE - 1, xMax);
+            int y1 = std::min(by + BLOCK_SIZE - 1, yMax);
+            if (hiZ != nullptr && minZ >= hiZ->getBlockDepth(x0, y0)) continue;
+            // edge functions are linear, so the block corners decide the classification
+            bool outside = false;
+            bool full = true;
+            long long origin[3];
+            for (int i = 0; i < 3; i++)
+            {
+                origin[i] = (long long)setup.a[i] * x0 + (long long)setup.b[i] * y0 + setup.c[i];
+                long long dx = (long long)setup.a[i] * (x1 - x0);
+                long long dy = (long long)setup.b[i] * (y1 - y0);
+                long long corner[4] = { origin[i], origin[i] + dx, origin[i] + dy, origin[i] + dx + dy };
+                int negative = 0;
+                for (int k = 0; k < 4; k++) negative += corner[k] < 0;
+                if (negative == 4) outside = true;
+                if (negative != 0) full = false;
+            }
+            if (outside) continue;
+            depthWritten = false;
+            for (int y = y0; y <= y1; y++)
+            {
+                long long w[3];
+                for (int i = 0; i < 3; i++) w[i] = origin[i] + (long long)setup.b[i] * (y - y0);
+                if (full)
+                {
+                    for (int x = x0; x <= x1; x++)
+                    {
+                        emit(x, y, w[0], w[1], w[2]);
+                        for (int i = 0; i < 3; i++) w[i] += setup.a[i];
+                    }
+                    continue;
+                }
+#ifdef __AVX2__
+                if (simd)
+                {
+                    // a lane is covered when none of the three weights has its sign bit set
+                    __m256i outsideLanes = _mm256_or_si256(_mm256_or_si256(
+                        _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(w[0])), stepA[0]),
+                        _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(w[1])), stepA[1])),
+                        _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(w[2])), stepA[2]));
+                    int mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(outsideLanes)) & ((1 << (x1 - x0 + 1)) - 1);
+                    while (mask)
+                    {
+                        int lane = lowestBit(mask);
+                        mask &= mask - 1;
+                        emit(x0 + lane, y, w[0] + (long long)setup.a[0] * lane, w[1] + (long long)setup.a[1] * lane, w[2] + (long long)setup.a[2] * lane);
+                    }
+                    continue;
+                }
+#endif
+                for (int x = x0; x <= x1; x++)
+                {
+                    if ((w[0] | w[1] | w[2]) >= 0) emit(x, y, w[0], w[1], w[2]);
+                    for (int i = 0; i < 3; i++) w[i] += setup.a[i];
+                }
+            }
+            if (hiZ != nullptr && depthWritten) hiZ->updateHiZ(x0, y0);
+        }
+    }
 }
 
 template<class T>
@@ -44,7 +154,7 @@ template<class T, size_t N>
 static inline std::bitset<N> getClipCode(T point, std::array<T, N>& clip)
 {
     std::bitset<N> res;
-    for (int i = 0; i < N; i++)
+    for (size_t i = 0; i < N; i++)
         if (calculateDistance(point, clip.at(i)) < 0) res.set(i, 1);
     return res;
 }
@@ -85,15 +195,35 @@ CoordI4D renderAPI::computeBoundingBox(Triangle& tri)
         yMax < height - 1 ? yMax : height - 1};
 }
 
-Vector3D renderAPI::computeBarycentric(Triangle& pts, CoordI2D P) {
-    Vector3D u1(pts.v2.screenPos.x - pts.v0.screenPos.x, pts.v1.screenPos.x - pts.v0.screenPos.x, pts.v0.screenPos.x - P[0]);
-    Vector3D u2(pts.v2.screenPos.y - pts.v0.screenPos.y, pts.v1.screenPos.y - pts.v0.screenPos.y, pts.v0.screenPos.y - P[1]);
-    Vector3D u = glm::cross(u1, u2);
-    /* `pts` and `P` has integer value as coordinates
-       so `abs(u[2])` < 1 means `u[2]` is 0, that means
-       triangle is degenerate, in this case return something with negative coordinates */
-    if (std::abs(u.z) < 1) return Vector3D(-1, 1, 1);
-    return Vector3D(1.f - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
+// triangle setup, edge i is the one opposite to vertex i
+TriangleSetup renderAPI::computeEdgeFunction(Triangle& tri)
+{
+    TriangleSetup setup;
+    const CoordI2D p[3] = { tri.v0.screenPos, tri.v1.screenPos, tri.v2.screenPos };
+    long long area = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        const CoordI2D& from = p[(i + 1) % 3];
+        const CoordI2D& to = p[(i + 2) % 3];
+        setup.a[i] = from.y - to.y;
+        setup.b[i] = to.x - from.x;
+        setup.c[i] = (long long)from.x * to.y - (long long)from.y * to.x;
+        area += setup.c[i];
+    }
+    // both windings are rasterized, flip the clockwise ones so inside is always >= 0
+    if (area < 0)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            setup.a[i] = -setup.a[i];
+            setup.b[i] = -setup.b[i];
+            setup.c[i] = -setup.c[i];
+        }
+        area = -area;
+    }
+    setup.degenerate = area == 0;
+    setup.invArea = setup.degenerate ? 0.f : 1.f / area;
+    return setup;
 }
 
 // initiaize clip plane and screen border
@@ -113,6 +243,29 @@ renderAPI::renderAPI(int _w, int _h):shader(nullptr), width(_w), height(_h), fra
         // bottom
         viewBox.at(5) = {0, -1.f, 0, 1.f};
     }
+    {
+        guardBand.at(0) = viewBox.at(0);
+        guardBand.at(1) = viewBox.at(1);
+        guardBand.at(2) = {1.f, 0, 0, GUARD_BAND};
+        guardBand.at(3) = {-1.f, 0, 0, GUARD_BAND};
+        guardBand.at(4) = {0, 1.f, 0, GUARD_BAND};
+        guardBand.at(5) = {0, -1.f, 0, GUARD_BAND};
+    }
+    setViewport();
+}
+
+// internal resolution change, the frame is reallocated so callers should change it in coarse steps
+void renderAPI::resize(int _w, int _h)
+{
+    if (_w == width && _h == height) return;
+    width = _w;
+    height = _h;
+    frame = Frame(width, height);
+    setViewport();
+}
+
+void renderAPI::setViewport()
+{
     {
         // left
         screenEdge.at(0) = {1.f, 0, 0};
@@ -123,36 +276,126 @@ renderAPI::renderAPI(int _w, int _h):shader(nullptr), width(_w), height(_h), fra
         // top
         screenEdge.at(3) = {0, -1.f, (float)height};
     }
+    // split screen into tiles for sort-middle rasterization
+    tileCols = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tileRows = (height + TILE_SIZE - 1) / TILE_SIZE;
+    tiles.resize(tileCols * tileRows);
+    for (int ty = 0; ty < tileRows; ty++)
+    {
+        for (int tx = 0; tx < tileCols; tx++)
+        {
+            tiles.at(ty * tileCols + tx).region = {
+                tx * TILE_SIZE,
+                ty * TILE_SIZE,
+                std::min((tx + 1) * TILE_SIZE, width) - 1,
+                std::min((ty + 1) * TILE_SIZE, height) - 1};
+        }
+    }
+}
+
+template<class ShaderT>
+void renderAPI::facesRender(Triangle &tri, const UniformBlock& block)
+{
+    facesRender<ShaderT>(tri, CoordI4D(0, 0, width - 1, height - 1), block);
 }
 
-// half-space triangle rasterization algorithm
-void renderAPI::facesRender(Triangle &tri)
+// half-space triangle rasterization algorithm, only pixels inside region are touched.
+// with a triangle id and deferred shading on, the fragment is only recorded in the visibility buffer
+template<class ShaderT>
+void renderAPI::facesRender(Triangle &tri, const CoordI4D& region, const UniformBlock& block, int triangleId)
 {
     CoordI4D boundingBox = computeBoundingBox(tri);
-    int xMin = boundingBox[0];
-    int yMin = boundingBox[1];
-    int xMax = boundingBox[2];
-    int yMax = boundingBox[3];
-    Vector3D P;
-    Fragment frag;
-    for (P.x = xMin; P.x <= xMax; P.x++)
+    int xMin = std::max(boundingBox[0], region[0]);
+    int yMin = std::max(boundingBox[1], region[1]);
+    int xMax = std::min(boundingBox[2], region[2]);
+    int yMax = std::min(boundingBox[3], region[3]);
+    if (xMin > xMax || yMin > yMax) return;
+    // whole triangle behind what is already drawn
+    float minZ = std::min(std::min(tri.v0.zValue, tri.v1.zValue), tri.v2.zValue);
+    if (minZ >= frame.getMaxDepth(xMin, yMin, xMax, yMax)) return;
+    TriangleSetup setup = computeEdgeFunction(tri);
+    UvGradient gradient = uvGradient(tri);
+    bool deferred = deferredShading && triangleId >= 0;
+    // fragments that pass the depth test are shaded FRAGMENT_BATCH at a time
+    FragmentBatch batch;
+    auto flush = [&]()
     {
-        for (P.y = yMin; P.y <= yMax; P.y++)
+        shaderAs<ShaderT>()->fragmentShader(batch, block);
+        for (int lane = 0; lane < batch.count; lane++)
         {
-            Vector3D baryPos = computeBarycentric(tri, CoordI2D(P.x, P.y));
-            if (isInTriangle(baryPos)) {
-                float Z = 1.0 / (baryPos[0] / tri.v0.clipPos.w + baryPos[1] / tri.v1.clipPos.w + baryPos[2] / tri.v2.clipPos.w);
-                P.z = baryPos[0] * tri.v0.clipPos.z / tri.v0.clipPos.w + baryPos[1] * tri.v1.clipPos.z / tri.v1.clipPos.w + baryPos[2] * tri.v2.clipPos.z / tri.v2.clipPos.w;
-                P.z *= Z;
-                if (frame.updateZbuffer(P.x, P.y, P.z))
-                {
-                    frag = interpolationFragment(P.x, P.y, P.z, tri, baryPos);
-                    shader->fragmentShader(frag);
-                    frame.setPixel(P.x, P.y, frag.fragmentColor);
-                }
+            if (packedWrite) frame.writePacked(batch.x[lane], batch.y[lane], batch.zValue[lane], batch.getColor(lane));
+            else frame.setPixel(batch.x[lane], batch.y[lane], batch.getColor(lane));
+        }
+        batch.count = 0;
+    };
+    // without tiles no thread owns a block, so hierarchical z is left alone. depth only
+    // decreases, the stale maxima stay conservative and packed draws refresh them on unpack
+    traverseTriangle(setup, xMin, yMin, xMax, yMax, minZ, sharedWrite ? nullptr : &frame, [&](int x, int y, Vector3D& baryPos)
+    {
+        float Z = 1.0 / (baryPos[0] / tri.v0.clipPos.w + baryPos[1] / tri.v1.clipPos.w + baryPos[2] / tri.v2.clipPos.w);
+        float z = baryPos[0] * tri.v0.clipPos.z / tri.v0.clipPos.w + baryPos[1] * tri.v1.clipPos.z / tri.v1.clipPos.w + baryPos[2] * tri.v2.clipPos.z / tri.v2.clipPos.w;
+        z *= Z;
+        if (packedWrite)
+        {
+            if (!frame.testPackedDepth(x, y, z)) return false;
+            interpolationFragment(batch, x, y, z, tri, baryPos, gradient);
+            if (batch.full()) flush();
+            return true;
+        }
+        if (frame.updateZbuffer(x, y, z))
+        {
+            if (deferred)
+            {
+                frame.setVisibility(x, y, triangleId, baryPos);
+                return true;
             }
+            interpolationFragment(batch, x, y, z, tri, baryPos, gradient);
+            if (batch.full()) flush();
+            return true;
+        }
+        return false;
+    });
+    if (batch.count > 0) flush();
+}
+
+// second pass of deferred shading, the pixels left in the visibility buffer are shaded exactly once
+template<class ShaderT>
+void renderAPI::visibilityShading(RasterTile& tile)
+{
+    // a batch only holds pixels of one draw, it is flushed when the draw changes
+    FragmentBatch batch;
+    const UniformBlock* batchBlock = nullptr;
+    // neighbouring pixels mostly share a triangle, its gradient is kept until the id changes
+    int gradientId = -1;
+    UvGradient gradient = {};
+    auto flush = [&]()
+    {
+        shaderAs<ShaderT>()->fragmentShader(batch, *batchBlock);
+        for (int lane = 0; lane < batch.count; lane++)
+            frame.setPixel(batch.x[lane], batch.y[lane], batch.getColor(lane));
+        batch.count = 0;
+    };
+    for (int y = tile.region[1]; y <= tile.region[3]; y++)
+    {
+        for (int x = tile.region[0]; x <= tile.region[2]; x++)
+        {
+            int id = frame.getTriangleId(x, y);
+            if (id < 0) continue;
+            Vector3D baryPos = frame.getBarycentric(x, y);
+            const UniformBlock* block = &drawUniforms[setupDraw(id)];
+            if (batch.count > 0 && block != batchBlock) flush();
+            batchBlock = block;
+            if (id != gradientId)
+            {
+                gradient = uvGradient(setupTriangle(id));
+                gradientId = id;
+            }
+            interpolationFragment(batch, x, y, frame.getDepth(x, y), setupTriangle(id), baryPos, gradient);
+            frame.resetVisibility(x, y);
+            if (batch.full()) flush();
         }
     }
+    if (batch.count > 0) flush();
 }
 
 void renderAPI::skyBoxFacesRender(Triangle& tri, int faceId)
@@ -162,23 +405,26 @@ void renderAPI::skyBoxFacesRender(Triangle& tri, int faceId)
     int yMin = boundingBox[1];
     int xMax = boundingBox[2];
     int yMax = boundingBox[3];
-    Vector3D P;
-    Fragment frag;
-    for (P.x = xMin; P.x <= xMax; P.x++)
+    TriangleSetup setup = computeEdgeFunction(tri);
+    UvGradient gradient = uvGradient(tri);
+    FragmentBatch batch;
+    auto flush = [&]()
     {
-        for (P.y = yMin; P.y <= yMax; P.y++)
-        {
-            Vector3D baryPos = computeBarycentric(tri, CoordI2D(P.x, P.y));
-            if (isInTriangle(baryPos)) {
-                float Z = 1.0 / (baryPos[0] / tri.v0.clipPos.w + baryPos[1] / tri.v1.clipPos.w + baryPos[2] / tri.v2.clipPos.w);
-                P.z = baryPos[0] * tri.v0.clipPos.z / tri.v0.clipPos.w + baryPos[1] * tri.v1.clipPos.z / tri.v1.clipPos.w + baryPos[2] * tri.v2.clipPos.z / tri.v2.clipPos.w;
-                P.z *= Z;
-                frag = interpolationFragment(P.x, P.y, P.z, tri, baryPos);
-                skyShader->fragmentShader(frag, faceId);
-                frame.setPixel(P.x, P.y, frag.fragmentColor);
-            }
-        }
-    }
+        skyShader->fragmentShader(batch, faceId);
+        for (int lane = 0; lane < batch.count; lane++)
+            frame.setPixel(batch.x[lane], batch.y[lane], batch.getColor(lane));
+        batch.count = 0;
+    };
+    traverseTriangle(setup, xMin, yMin, xMax, yMax, 0.f, nullptr, [&](int x, int y, Vector3D& baryPos)
+    {
+        float Z = 1.0 / (baryPos[0] / tri.v0.clipPos.w + baryPos[1] / tri.v1.clipPos.w + baryPos[2] / tri.v2.clipPos.w);
+        float z = baryPos[0] * tri.v0.clipPos.z / tri.v0.clipPos.w + baryPos[1] * tri.v1.clipPos.z / tri.v1.clipPos.w + baryPos[2] * tri.v2.clipPos.z / tri.v2.clipPos.w;
+        z *= Z;
+        interpolationFragment(batch, x, y, z, tri, baryPos, gradient);
+        if (batch.full()) flush();
+        return false;
+    });
+    if (batch.count > 0) flush();
 }
 
 // Bresenham's line algorithm
@@ -280,8 +526,10 @@ void renderAPI::pointsRender(Triangle &tri)
         frame.setPixel(tri.v2.screenPos.x, tri.v2.screenPos.y, pointColor);
 }
 
-// clip triangle, Cohen-Sutherland algorithm & Sutherland-Hodgman algorithm in homogeneous space
-std::vector<Triangle> renderAPI::faceClip(Triangle &tri)
+// clip triangle, Cohen-Sutherland algorithm & Sutherland-Hodgman algorithm in homogeneous space.
+// the viewport planes only reject, clipping runs on stack polygons against near, far and the guard band,
+// so most triangles near the screen edge pass through untouched
+bool renderAPI::faceClip(Triangle &tri, ClipPolygon& poly, bool clipFar)
 {
     std::bitset<6> code[3] =
     {
@@ -289,86 +537,400 @@ std::vector<Triangle> renderAPI::faceClip(Triangle &tri)
         getClipCode(tri.v1.clipPos, viewBox),
         getClipCode(tri.v2.clipPos, viewBox)
     };
-    if((code[0] | code[1] | code[2]).none())
-        return {tri};
     if((code[0] & code[1] & code[2]).any())
-        return {};
-    if(((code[0] ^ code[1])[0]) || ((code[1] ^ code[2])[0]) || ((code[2] ^ code[0])[0])) // intersects near plane
+        return false;
+    std::bitset<6> crossed = getClipCode(tri.v0.clipPos, guardBand) | getClipCode(tri.v1.clipPos, guardBand) | getClipCode(tri.v2.clipPos, guardBand);
+    if (!clipFar) crossed.reset(1);
+    poly.vertices[0] = tri.v0;
+    poly.vertices[1] = tri.v1;
+    poly.vertices[2] = tri.v2;
+    poly.count = 3;
+    if (crossed.none())
+        return true;
+    ClipPolygon scratch;
+    ClipPolygon* in = &poly;
+    ClipPolygon* out = &scratch;
+    for (int i = 0; i < 6; i++)
     {
-        std::vector<Vertex> res;
-        for(int i = 0; i < 3; i++)
+        if (!crossed[i]) continue;
+        out->count = 0;
+        for (int j = 0; j < in->count; j++)
         {
-            int k = (i + 1) % 3;
-            Vertex ths, nex;
-            if (i == 0) { ths = tri.v0; nex = tri.v1; }
-            else if (i == 1) { ths = tri.v1; nex = tri.v2; }
-            else { ths = tri.v2; nex = tri.v0; }
-            if(!code[i][0] && !code[k][0])
-            {
-                res.push_back(nex);
-            }
-            else if(!code[i][0] && code[k][0])
-            {
-                float da = calculateDistance(ths.clipPos, viewBox.at(0));
-                float db = calculateDistance(nex.clipPos, viewBox.at(0));
-                float alpha = da / (da - db);
-                Vertex np = calculateInterpolation(ths, nex, alpha);
-                res.push_back(np);
-            }
-            else if(code[i][0] && !code[k][0])
-            {
-                float da = calculateDistance(ths.clipPos, viewBox.at(0));
-                float db = calculateDistance(nex.clipPos, viewBox.at(0));
-                float alpha = da / (da - db);
-                Vertex np = calculateInterpolation(ths, nex, alpha);
-                res.push_back(np);
-                res.push_back(nex);
-            }
+            const Vertex& ths = in->vertices[j];
+            const Vertex& nex = in->vertices[(j + 1) % in->count];
+            float da = calculateDistance(ths.clipPos, guardBand.at(i));
+            float db = calculateDistance(nex.clipPos, guardBand.at(i));
+            if (da >= 0) out->vertices[out->count++] = ths;
+            if ((da >= 0) != (db >= 0)) out->vertices[out->count++] = calculateInterpolation(ths, nex, da / (da - db));
+        }
+        std::swap(in, out);
+        if (in->count < 3) return false;
+    }
+    if (in != &poly)
+    {
+        for (int j = 0; j < in->count; j++) poly.vertices[j] = in->vertices[j];
+        poly.count = in->count;
+    }
+    return true;
+}
+
+// winding test in homogeneous clip space, det[x y w] keeps its sign through the perspective divide,
+// so it can run before clipping. counter-clockwise faces are front faces
+bool renderAPI::isBackFace(Triangle& tri)
+{
+    const Coord4D& a = tri.v0.clipPos;
+    const Coord4D& b = tri.v1.clipPos;
+    const Coord4D& c = tri.v2.clipPos;
+    float det = a.x * (b.y * c.w - c.y * b.w) - a.y * (b.x * c.w - c.x * b.w) + a.w * (b.x * c.y - c.x * b.y);
+    return det <= 0.f;
+}
+
+// faces and transformed vertices are numbered across the draws of a submission
+static inline int findRange(const std::vector<size_t>& offsets, size_t index)
+{
+    return static_cast<int>(std::upper_bound(offsets.begin(), offsets.end(), index) - offsets.begin()) - 1;
+}
+
+int renderAPI::drawOf(int faceId)
+{
+    return findRange(faceOffsets, faceId);
+}
+
+// post-transform vertex cache, every unique vertex of the indexed draws is shaded once
+template<class ShaderT>
+void renderAPI::transformVertices()
+{
+    transformedVertices.resize(vertexOffsets.back());
+    auto transform = [&](size_t begin, size_t end)
+    {
+        int drawId = findRange(vertexOffsets, begin);
+        for (size_t i = begin; i < end; i++)
+        {
+            while (i >= vertexOffsets[drawId + 1]) drawId++;
+            const DrawCall& call = drawCalls[drawId];
+            transformedVertices[i] = call.vertices[i - vertexOffsets[drawId]];
+            shaderAs<ShaderT>()->vertexShader(transformedVertices[i], call.ifAnimation);
         }
-        return constructTriangle(res);
+    };
+    if (multiThread)
+    {
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, transformedVertices.size(), 2500),
+            [&](tbb::blocked_range<size_t> r) { transform(r.begin(), r.end()); });
+    }
+    else
+    {
+        transform(0, transformedVertices.size());
+    }
+}
+
+// triangle assembly, read the shaded vertices of an indexed draw or shade a copy of the face's own.
+// the mesh data is never written, the shaded face only goes to the draw's output when there is one
+template<class ShaderT>
+Triangle renderAPI::vertexProcess(int drawId, int faceId)
+{
+    const DrawCall& call = drawCalls[drawId];
+    size_t local = faceId - faceOffsets[drawId];
+    Triangle tri = call.faces[local];
+    if (call.indices != nullptr)
+    {
+        const Vertex* shaded = transformedVertices.data() + vertexOffsets[drawId];
+        tri.v0 = shaded[call.indices[local * 3]];
+        tri.v1 = shaded[call.indices[local * 3 + 1]];
+        tri.v2 = shaded[call.indices[local * 3 + 2]];
     }
-    return std::vector<Triangle>{tri};
+    else
+    {
+        shaderAs<ShaderT>()->vertexShader(tri.v0, call.ifAnimation);
+        shaderAs<ShaderT>()->vertexShader(tri.v1, call.ifAnimation);
+        shaderAs<ShaderT>()->vertexShader(tri.v2, call.ifAnimation);
+    }
+    if (call.output != nullptr) call.output[local] = tri;
+    return tri;
 }
 
 // process triangle, clip triangle and choose one mode {TRIANGLE,LINE,POINT} to render.
-void renderAPI::rasterization(Triangle &tri, bool ifAnimation)
+// returns false when the face is culled
+template<class ShaderT, renderMode Mode>
+bool renderAPI::rasterization(int faceId)
 {
-    shader->vertexShader(tri.v0, ifAnimation);
-    shader->vertexShader(tri.v1, ifAnimation);
-    shader->vertexShader(tri.v2, ifAnimation);
-    std::vector<Triangle> completedTriangleList = faceClip(tri);
-    for (auto &ctri : completedTriangleList)
+    int drawId = drawOf(faceId);
+    Triangle tri = vertexProcess<ShaderT>(drawId, faceId);
+    if (faceCulling && isBackFace(tri)) return false;
+    ClipPolygon poly;
+    if (!faceClip(tri, poly)) return true;
+    for (int k = 0; k < poly.triangleCount(); k++)
     {
+        Triangle ctri = poly.triangle(k);
         perspectiveTrans(ctri);
         convertToScreen(ctri);
-        if(renderMode == FACE)facesRender(ctri);
-        else if(renderMode == EDGE) wireframeRedner(ctri);
-        else if(renderMode == VERTEX) pointsRender(ctri);
+        if constexpr (Mode == FACE) facesRender<ShaderT>(ctri, drawUniforms[drawId]);
+        else if constexpr (Mode == EDGE) wireframeRedner(ctri);
+        else if constexpr (Mode == VERTEX) pointsRender(ctri);
     }
+    return true;
 }
 
-// main render function
-void renderAPI::render(bool ifAnimation)
+// vertex shading, clipping and screen mapping of one face, results are kept for binning.
+// returns false when the face is culled
+template<class ShaderT>
+bool renderAPI::geometryProcess(int faceId)
 {
-    if(multiThread)
+    int drawId = drawOf(faceId);
+    Triangle tri = vertexProcess<ShaderT>(drawId, faceId);
+    if (faceCulling && isBackFace(tri)) return false;
+    ClipPolygon poly;
+    if (!faceClip(tri, poly)) return true;
+    int count = poly.triangleCount();
+    setupDrawIds.at(faceId) = drawId;
+    if (count > 2)
     {
-        tbb::parallel_for(tbb::blocked_range<size_t>(0, faces.size(), 2500),
+        auto first = setupOverflow.grow_by(count - 2, OverflowTriangle{ poly.triangle(0), CoordI4D(), drawId });
+        setupOverflowStart.at(faceId) = static_cast<int>(first - setupOverflow.begin());
+    }
+    for (int k = 0; k < count; k++)
+    {
+        int id = setupId(faceId, k);
+        Triangle& ctri = setupTriangle(id);
+        ctri = poly.triangle(k);
+        perspectiveTrans(ctri);
+        convertToScreen(ctri);
+        setupBound(id) = computeBoundingBox(ctri);
+    }
+    setupCount.at(faceId) = count;
+    return true;
+}
+
+// ids below 2 * faces index the per face slots, the rest index the overflow
+int renderAPI::setupId(int faceId, int k)
+{
+    if (k < 2) return faceId * 2 + k;
+    return static_cast<int>(totalFaces * 2) + setupOverflowStart.at(faceId) + k - 2;
+}
+
+int renderAPI::setupDraw(int id)
+{
+    return static_cast<size_t>(id) < totalFaces * 2 ? setupDrawIds[id / 2] : setupOverflow[id - totalFaces * 2].drawId;
+}
+
+Triangle& renderAPI::setupTriangle(int id)
+{
+    return static_cast<size_t>(id) < totalFaces * 2 ? setupTriangles.at(id) : setupOverflow[id - totalFaces * 2].tri;
+}
+
+CoordI4D& renderAPI::setupBound(int id)
+{
+    return static_cast<size_t>(id) < totalFaces * 2 ? setupBounds.at(id) : setupOverflow[id - totalFaces * 2].bounds;
+}
+
+// visit every tile overlapped by a setup triangle of the chunk's faces, in submission order
+template<class Visit>
+void renderAPI::forEachBin(size_t chunk, size_t chunks, Visit visit)
+{
+    size_t begin = totalFaces * chunk / chunks;
+    size_t end = totalFaces * (chunk + 1) / chunks;
+    for (size_t i = begin; i < end; i++)
+    {
+        for (int k = 0; k < setupCount[i]; k++)
+        {
+            int id = setupId(static_cast<int>(i), k);
+            const CoordI4D& boundingBox = setupBound(id);
+            if (boundingBox[0] > boundingBox[2] || boundingBox[1] > boundingBox[3]) continue;
+            for (int ty = boundingBox[1] / TILE_SIZE; ty <= boundingBox[3] / TILE_SIZE; ty++)
+                for (int tx = boundingBox[0] / TILE_SIZE; tx <= boundingBox[2] / TILE_SIZE; tx++)
+                    visit(static_cast<size_t>(ty * tileCols + tx), id);
+        }
+    }
+}
+
+// every triangle is binned once: count per chunk and tile, prefix sum per tile, then scatter.
+// chunks are contiguous face ranges, so each tile keeps submission order
+void renderAPI::binTriangles()
+{
+    size_t tileCount = tiles.size();
+    size_t chunks = std::max<size_t>(1, std::min<size_t>(BIN_CHUNKS, (totalFaces + 2499) / 2500));
+    binOffsets.assign(chunks * tileCount, 0);
+    tbb::parallel_for(size_t(0), chunks, [&](size_t c)
+    {
+        size_t* counts = &binOffsets[c * tileCount];
+        forEachBin(c, chunks, [&](size_t t, int) { counts[t]++; });
+    });
+    tbb::parallel_for(size_t(0), tileCount, [&](size_t t)
+    {
+        size_t sum = 0;
+        for (size_t c = 0; c < chunks; c++)
+        {
+            size_t count = binOffsets[c * tileCount + t];
+            binOffsets[c * tileCount + t] = sum;
+            sum += count;
+        }
+        tiles[t].triangleIds.resize(sum);
+    });
+    tbb::parallel_for(size_t(0), chunks, [&](size_t c)
+    {
+        size_t* offsets = &binOffsets[c * tileCount];
+        forEachBin(c, chunks, [&](size_t t, int id) { tiles[t].triangleIds[offsets[t]++] = id; });
+    });
+}
+
+// sort-middle rendering: every tile is rasterized by a single worker, so depth test and color write never race.
+// the stages run once over the faces of all draws, small meshes share the workers instead of each paying a barrier
+template<class ShaderT>
+void renderAPI::tiledRender()
+{
+    if (setupTriangles.size() < totalFaces * 2)
+    {
+        setupTriangles.resize(totalFaces * 2, Triangle(Vertex(), Vertex(), Vertex()));
+        setupBounds.resize(totalFaces * 2);
+    }
+    setupCount.assign(totalFaces, 0);
+    setupOverflowStart.resize(totalFaces);
+    setupDrawIds.resize(totalFaces);
+    setupOverflow.clear();
+    {
+        ScopedTimer timer(STAGE_CLIP);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, totalFaces, 2500),
+            [&](tbb::blocked_range<size_t> r)
+            {
+                long long culled = 0;
+                for (size_t i = r.begin(); i < r.end(); i++)
+                    if (!geometryProcess<ShaderT>(static_cast<int>(i))) culled++;
+                culledCount += culled;
+            });
+        binTriangles();
+    }
+    {
+        ScopedTimer timer(STAGE_RASTER);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, tiles.size(), 1),
+            [&](tbb::blocked_range<size_t> r)
+            {
+                for (size_t t = r.begin(); t < r.end(); t++)
+                {
+                    RasterTile& tile = tiles.at(t);
+                    for (int id : tile.triangleIds)
+                        facesRender<ShaderT>(setupTriangle(id), tile.region, drawUniforms[setupDraw(id)], id);
+                }
+            });
+    }
+    // ids refer to this submission's triangles, so the visibility buffer is resolved before it ends
+    if (deferredShading)
+    {
+        ScopedTimer timer(STAGE_FRAGMENT);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, tiles.size(), 1),
+            [&](tbb::blocked_range<size_t> r)
+            {
+                for (size_t t = r.begin(); t < r.end(); t++)
+                    if (!tiles.at(t).triangleIds.empty()) visibilityShading<ShaderT>(tiles.at(t));
+            });
+    }
+}
+
+// main render function. shaders known here run a specialized pipeline over the whole submission,
+// others go through the virtual interface one draw at a time, their batched path reads their own uniform
+void renderAPI::render(const DrawCall* calls, size_t count)
+{
+    // the packed buffer is filled once for the whole submission rather than around every draw
+    bool packed = multiThread && !tiledRaster && atomicWrite && renderMode == FACE;
+    if (packed)
+    {
+        ScopedTimer timer(STAGE_RASTER);
+        frame.packBuffer();
+        packedWrite = true;
+    }
+    if (dynamic_cast<BlinnPhongShader*>(shader.get()) != nullptr)
+    {
+        drawMode<BlinnPhongShader>(calls, count);
+    }
+    else
+    {
+        for (size_t i = 0; i < count; i++) drawMode<Shader>(calls + i, 1);
+    }
+    if (packed)
+    {
+        ScopedTimer timer(STAGE_RASTER);
+        frame.unpackBuffer();
+        packedWrite = false;
+    }
+}
+
+template<class ShaderT>
+void renderAPI::drawMode(const DrawCall* calls, size_t count)
+{
+    if (renderMode == FACE) draw<ShaderT, FACE>(calls, count);
+    else if (renderMode == EDGE) draw<ShaderT, EDGE>(calls, count);
+    else draw<ShaderT, VERTEX>(calls, count);
+}
+
+// the pipeline of one submission with shader type and mode fixed at compile time. with a final ShaderT
+// the shader calls are resolved statically and can be inlined into the raster loop.
+// the draws share the shader's matrices, material bindings are resolved per draw
+template<class ShaderT, renderMode Mode>
+void renderAPI::draw(const DrawCall* calls, size_t count)
+{
+    static const std::vector<TextureHandle> noTextures;
+    drawCalls = calls;
+    drawCount = count;
+    faceOffsets.assign(1, 0);
+    vertexOffsets.assign(1, 0);
+    drawUniforms.resize(count);
+    for (size_t d = 0; d < count; d++)
+    {
+        const DrawCall& call = calls[d];
+        faceOffsets.push_back(faceOffsets.back() + call.faceCount);
+        vertexOffsets.push_back(vertexOffsets.back() + (call.indices != nullptr ? call.vertexCount : 0));
+        if (call.diffuseIds != nullptr && call.specularIds != nullptr)
+            shader->setMaterialTextures(*call.diffuseIds, *call.specularIds);
+        shaderAs<ShaderT>()->updateUniforms(call.textures != nullptr ? *call.textures : noTextures);
+        drawUniforms[d] = shaderAs<ShaderT>()->uniform;
+    }
+    totalFaces = faceOffsets.back();
+    faceCount += static_cast<long long>(totalFaces);
+    if (vertexOffsets.back() > 0)
+    {
+        ScopedTimer timer(STAGE_VERTEX);
+        transformVertices<ShaderT>();
+    }
+    if (multiThread && tiledRaster && Mode == FACE)
+    {
+        tiledRender<ShaderT>();
+    }
+    else if(multiThread)
+    {
+        ScopedTimer timer(STAGE_RASTER);
+        sharedWrite = true;
+        // packs here only when render did not already do it for the submission
+        bool ownsPack = atomicWrite && Mode == FACE && !packedWrite;
+        if (ownsPack)
+        {
+            frame.packBuffer();
+            packedWrite = true;
+        }
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, totalFaces, 2500),
             [&](tbb::blocked_range<size_t> r)
             {
+                long long culled = 0;
                 for (size_t i = r.begin(); i < r.end(); i++)
-                    rasterization(faces.at(i), ifAnimation);
+                    if (!rasterization<ShaderT, Mode>(static_cast<int>(i))) culled++;
+                culledCount += culled;
             });
+        if (ownsPack)
+        {
+            frame.unpackBuffer();
+            packedWrite = false;
+        }
+        sharedWrite = false;
     }
     else
     {
-        for(int i = 0; i < faces.size(); i++)
-            rasterization(faces.at(i), ifAnimation);
+        ScopedTimer timer(STAGE_RASTER);
+        for(size_t i = 0; i < totalFaces; i++)
+            if (!rasterization<ShaderT, Mode>(static_cast<int>(i))) culledCount++;
     }
 }
 
 // render skybox
 void renderAPI::renderSkyBox()
 {
+    ScopedTimer timer(STAGE_SKYBOX);
     if (multiThread)
     {
         tbb::parallel_for(tbb::blocked_range<size_t>(0, skyBoxModel.size()),
@@ -378,29 +940,42 @@ void renderAPI::renderSkyBox()
                     skyShader->vertexShader(skyBoxModel.at(i).v0);
                     skyShader->vertexShader(skyBoxModel.at(i).v1);
                     skyShader->vertexShader(skyBoxModel.at(i).v2);
-                    std::vector<Triangle> completedTriangleList = faceClip(skyBoxModel.at(i));
-                    for (int j = 0; j < completedTriangleList.size(); j++)
+                    // drawn without depth, so the far plane is left alone and never cuts the box
+                    ClipPolygon poly;
+                    if (!faceClip(skyBoxModel.at(i), poly, false)) continue;
+                    for (int j = 0; j < poly.triangleCount(); j++)
                     {
-                        perspectiveTrans(completedTriangleList[j]);
-                        convertToScreen(completedTriangleList[j]);
-                        skyBoxFacesRender(completedTriangleList[j], i);
+                        Triangle ctri = poly.triangle(j);
+                        perspectiveTrans(ctri);
+                        convertToScreen(ctri);
+                        skyBoxFacesRender(ctri, i);
                     }
                 }
             });
     }
     else
     {
-        for (int i = 0; i < skyBoxModel.size(); i++) {
+        for (size_t i = 0; i < skyBoxModel.size(); i++) {
             skyShader->vertexShader(skyBoxModel.at(i).v0);
             skyShader->vertexShader(skyBoxModel.at(i).v1);
             skyShader->vertexShader(skyBoxModel.at(i).v2);
-            std::vector<Triangle> completedTriangleList = faceClip(skyBoxModel.at(i));
-            for (int j = 0; j < completedTriangleList.size(); j++)
+            ClipPolygon poly;
+            if (!faceClip(skyBoxModel.at(i), poly, false)) continue;
+            for (int j = 0; j < poly.triangleCount(); j++)
             {
-                perspectiveTrans(completedTriangleList[j]);
-                convertToScreen(completedTriangleList[j]);
-                skyBoxFacesRender(completedTriangleList[j], i);
+                Triangle ctri = poly.triangle(j);
+                perspectiveTrans(ctri);
+                convertToScreen(ctri);
+                skyBoxFacesRender(ctri, i);
             }
         }
     }
 }
+
+// pipelines other translation units may draw with directly
+template void renderAPI::draw<Shader, FACE>(const DrawCall*, size_t);
+template void renderAPI::draw<Shader, EDGE>(const DrawCall*, size_t);
+template void renderAPI::draw<Shader, VERTEX>(const DrawCall*, size_t);
+template void renderAPI::draw<BlinnPhongShader, FACE>(const DrawCall*, size_t);
+template void renderAPI::draw<BlinnPhongShader, EDGE>(const DrawCall*, size_t);
+template void renderAPI::draw<BlinnPhongShader, VERTEX>(const DrawCall*, size_t);
@@ -4,27 +4,100 @@
 #include <optional>
 #include <memory>
 #include <climits>
+#include <atomic>
 #include <immintrin.h>
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_for_each.h>
 #include <tbb/blocked_range2d.h>
+#include <tbb/concurrent_vector.h>
 #include "triangle.h"
 #include "tools.h"
 #include "frame.h"
+#include "textureCache.h"
 #include "shader.h"
 #include "skyBoxShader.h"
+#include "profiler.h"
 
 class Shader;
 class SkyBoxShader;
 
+// integer edge equations of a screen space triangle, w_i(x, y) = a_i * x + b_i * y + c_i
+// w_i is the unnormalized barycentric weight of vertex i, all three are >= 0 inside the triangle
+struct TriangleSetup
+{
+    int a[3];
+    int b[3];
+    long long c[3];
+    float invArea;
+    bool degenerate;
+};
+
+// a triangle clipped by all six planes has at most 3 + 6 vertices
+#define MAX_CLIP_VERTICES 9
+// upper bound of face ranges binned in parallel
+#define BIN_CHUNKS 64
+// guard band extent in viewport sizes, x and y are only clipped for triangles reaching past it
+#define GUARD_BAND 4.f
+
+// fixed capacity polygon of the clipper, kept on the stack and split into a triangle fan
+struct ClipPolygon
+{
+    Vertex vertices[MAX_CLIP_VERTICES];
+    int count = 0;
+    int triangleCount() const { return count >= 3 ? count - 2 : 0; }
+    Triangle triangle(int k) const { return Triangle(vertices[0], vertices[k + 1], vertices[k + 2]); }
+};
+
+// one draw call, every pointer refers to caller-owned mesh data that is read in place and must
+// stay alive during render. indices are optional, three per face into vertices for an indexed draw.
+// output is optional too, when set the shaded faces are written there. the material ids index textures
+struct DrawCall
+{
+    const Triangle* faces = nullptr;
+    size_t faceCount = 0;
+    const Vertex* vertices = nullptr;
+    size_t vertexCount = 0;
+    const int* indices = nullptr;
+    const std::vector<TextureHandle>* textures = nullptr;
+    const std::vector<int>* diffuseIds = nullptr;
+    const std::vector<int>* specularIds = nullptr;
+    Triangle* output = nullptr;
+    bool ifAnimation = false;
+};
+
+// setup triangle past the two slots of its face
+struct OverflowTriangle
+{
+    Triangle tri;
+    CoordI4D bounds;
+    int drawId;
+};
+
+// per frame counters, reset by clearBuffer
+struct RenderStatistics
+{
+    long long faceCount = 0;
+    long long culledCount = 0;
+};
+
+// screen tile of the sort-middle rasterizer, owned by one worker at a time
+struct RasterTile
+{
+    CoordI4D region;
+    std::vector<int> triangleIds;
+};
+
 class renderAPI
 {
 public:
-    renderMode renderMode{ FACE };
+    ::renderMode renderMode{ FACE };
     bool faceCulling{ true };
     bool multiThread{ true };
-    std::vector<Triangle> faces;
-    std::vector<Texture> textureList;
+    bool tiledRaster{ true };
+    // raster pass only writes depth and visibility, every visible pixel is shaded once afterwards (tiled path only)
+    bool deferredShading{ false };
+    // untiled multi-thread path resolves depth and color with one atomic operation per fragment
+    bool atomicWrite{ true };
     std::vector<Texture> skyBoxTexture;
     std::vector<Triangle> skyBoxModel;
     std::unique_ptr<Shader> shader;
@@ -33,11 +106,20 @@ public:
     Color pointColor = Color(0.0, 0.0, 0.0);
     Color lineColor = Color(0.0, 0.0, 0.0);
     renderAPI(int _w,int _h);
-    void clearBuffer() { frame.clearBuffer(backgroundColor); }
+    void clearBuffer() { ScopedTimer timer(STAGE_CLEAR); frame.clearBuffer(backgroundColor); faceCount = 0; culledCount = 0; }
+    RenderStatistics getStatistics() { return { faceCount.load(), culledCount.load() }; }
     void setFrame(Frame f) { frame = f; }
-    QImage& getBuffer(){ return frame.getImage(); }
+    void resize(int _w, int _h);
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    QImage getBuffer(){ return frame.getImage(); }
     bool saveImage(QString path){ return frame.saveImage(path); }
-    void render(bool ifAnimation);
+    // all draws of a submission share the stages of one pipeline, faces are numbered across them
+    void render(const DrawCall* calls, size_t count);
+    void render(const DrawCall& call) { render(&call, 1); }
+    // statically dispatched pipeline, shader must be a ShaderT
+    template<class ShaderT, ::renderMode Mode>
+    void draw(const DrawCall* calls, size_t count);
     void renderSkyBox();
     static void init(int w, int h)
     {
@@ -58,10 +140,65 @@ private:
     int width;
     int height;
     std::array<BorderPlane, 6> viewBox;
+    std::array<BorderPlane, 6> guardBand;
     std::array<BorderLine, 4> screenEdge;
     Frame frame;
-    void rasterization(Triangle& tri, bool ifAnimation);
-    void facesRender(Triangle& tri);
+    int tileCols;
+    int tileRows;
+    std::vector<RasterTile> tiles;
+    std::vector<Triangle> setupTriangles;
+    std::vector<CoordI4D> setupBounds;
+    std::vector<int> setupCount;
+    // draw of each face, looked up once in geometryProcess
+    std::vector<int> setupDrawIds;
+    // the two slots per face hold near plane clipping, rarer extra fan triangles live here
+    tbb::concurrent_vector<OverflowTriangle> setupOverflow;
+    std::vector<int> setupOverflowStart;
+    std::atomic<long long> faceCount{ 0 };
+    std::atomic<long long> culledCount{ 0 };
+    bool packedWrite{ false };
+    // set while faces are drawn in parallel without tiles
+    bool sharedWrite{ false };
+    std::vector<Vertex> transformedVertices;
+    // the submission being drawn, offsets[d] is the first face or transformed vertex of draw d
+    const DrawCall* drawCalls{ nullptr };
+    size_t drawCount{ 0 };
+    size_t totalFaces{ 0 };
+    std::vector<size_t> faceOffsets;
+    std::vector<size_t> vertexOffsets;
+    std::vector<UniformBlock> drawUniforms;
+    void setViewport();
+    int drawOf(int faceId);
+    template<class ShaderT>
+    ShaderT* shaderAs() { return static_cast<ShaderT*>(shader.get()); }
+    template<class ShaderT>
+    void drawMode(const DrawCall* calls, size_t count);
+    template<class ShaderT>
+    void transformVertices();
+    template<class ShaderT>
+    Triangle vertexProcess(int drawId, int faceId);
+    template<class ShaderT, ::renderMode Mode>
+    bool rasterization(int faceId);
+    template<class ShaderT>
+    bool geometryProcess(int faceId);
+    bool isBackFace(Triangle& tri);
+    int setupId(int faceId, int k);
+    int setupDraw(int id);
+    Triangle& setupTriangle(int id);
+    CoordI4D& setupBound(int id);
+    // chunk major per tile counts, then write offsets, of the binning pass
+    std::vector<size_t> binOffsets;
+    template<class Visit>
+    void forEachBin(size_t chunk, size_t chunks, Visit visit);
+    void binTriangles();
+    template<class ShaderT>
+    void tiledRender();
+    template<class ShaderT>
+    void facesRender(Triangle& tri, const UniformBlock& block);
+    template<class ShaderT>
+    void facesRender(Triangle& tri, const CoordI4D& region, const UniformBlock& block, int triangleId = -1);
+    template<class ShaderT>
+    void visibilityShading(RasterTile& tile);
     void skyBoxFacesRender(Triangle& tri, int faceId);
     void wireframeRedner(Triangle& tri);
     void pointsRender(Triangle &tri);
@@ -69,7 +206,7 @@ private:
     void convertToScreen(Triangle& tri);
     void perspectiveTrans(Triangle& tri);
     CoordI4D computeBoundingBox(Triangle& tri);
-    Vector3D computeBarycentric(Triangle& pts, CoordI2D P);
-    std::vector<Triangle> faceClip(Triangle& tri);
+    TriangleSetup computeEdgeFunction(Triangle& tri);
+    bool faceClip(Triangle& tri, ClipPolygon& poly, bool clipFar = true);
     std::optional<Line> lineClip(Line& line);
 };
@@ -0,0 +1,31 @@
+#include "resolutionScaler.h"
+#include <cmath>
+#include <algorithm>
+
+float ResolutionScaler::update(float frameTime, bool moving)
+{
+    stillFrames = moving ? 0 : stillFrames + 1;
+    if (stillFrames >= idleFrames)
+    {
+        scale = 1.f;
+        averageTime = 0.f;
+        return scale;
+    }
+    // exponential average, one slow frame does not change the resolution on its own
+    averageTime = averageTime == 0.f ? frameTime : averageTime * 0.75f + frameTime * 0.25f;
+    // grow only with some headroom, otherwise the scale would flip between two steps
+    if (averageTime > targetTime || averageTime < targetTime * 0.7f)
+    {
+        float fullTime = averageTime / (scale * scale);
+        float wanted = std::sqrt(targetTime * 0.85f / fullTime);
+        float stepped = std::floor(wanted * RESOLUTION_STEPS) / RESOLUTION_STEPS;
+        float next = std::clamp(stepped, minScale, 1.f);
+        if (next != scale)
+        {
+            scale = next;
+            // the average was measured at the old scale
+            averageTime = fullTime * scale * scale;
+        }
+    }
+    return scale;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// scale steps of the internal resolution, coarse so the frame is not reallocated every frame
+#define RESOLUTION_STEPS 8
+
+// picks the internal render scale from recent frame times so a frame fits the budget.
+// raster cost is taken as proportional to the pixel count, i.e. to the square of the scale
+class ResolutionScaler
+{
+public:
+    float targetTime = 33.f;
+    float minScale = 0.5f;
+    // frames without camera motion before going back to full resolution
+    int idleFrames = 8;
+    // feed the time of the frame just drawn in ms, returns the scale for the next one
+    float update(float frameTime, bool moving);
+    float getScale() const { return scale; }
+    void reset() { scale = 1.f; averageTime = 0.f; stillFrames = 0; }
+private:
+    float scale = 1.f;
+    float averageTime = 0.f;
+    int stillFrames = 0;
+};
@@ -4,6 +4,7 @@
 #include <cmath>
 #include <string>
 #include <functional>
+#include "textureCache.h"
 #include "renderAPI.h"
 
 class renderAPI;
@@ -11,14 +12,73 @@ class renderAPI;
 class Shader
 {
 public:
-    glm::mat4 modelMat;
-    glm::mat4 viewMat;
-    glm::mat4 projectionMat;
     std::vector<Light> lightList;
-    Material material;
-    Coord3D eyePos;
     std::vector<glm::mat4> joint_matrices;
     std::vector<glm::mat3> joint_n_matrices;
+    UniformBlock uniform;
     virtual void vertexShader(Vertex &vertex, bool ifAnimation) = 0;
     virtual void fragmentShader(Fragment &fragment) = 0;
-};
+    // batched entry with the uniforms of the batch's draw. shaders without a batched path shade the
+    // covered lanes one at a time from their own uniform, so the renderer submits their draws one by one
+    virtual void fragmentShader(FragmentBatch &batch, const UniformBlock &)
+    {
+        for (int lane = 0; lane < batch.count; lane++)
+        {
+            Fragment frag = batch.get(lane);
+            fragmentShader(frag);
+            batch.setColor(lane, frag.fragmentColor);
+        }
+    }
+    void setModelMat(const glm::mat4& mat) { if (mat != modelMat) { modelMat = mat; dirty |= MODEL_DIRTY; } }
+    void setViewMat(const glm::mat4& mat) { if (mat != viewMat) { viewMat = mat; dirty |= VIEW_PROJ_DIRTY; } }
+    void setProjectionMat(const glm::mat4& mat) { if (mat != projectionMat) { projectionMat = mat; dirty |= VIEW_PROJ_DIRTY; } }
+    void setEyePos(const Coord3D& pos) { uniform.eyePos = pos; }
+    void setShininess(float shininess) { uniform.shininess = shininess; }
+    void setTextureFilter(TextureFilter filter) { uniform.filter = filter; }
+    void setMaterialTextures(const std::vector<int>& diffuse, const std::vector<int>& specular)
+    {
+        if (diffuse == material.diffuse && specular == material.specular) return;
+        material.diffuse = diffuse;
+        material.specular = specular;
+        dirty |= MATERIAL_DIRTY;
+    }
+    // called once at the start of a draw, the texture list is the one the material ids index
+    void updateUniforms(const std::vector<TextureHandle>& textures)
+    {
+        if (dirty & MODEL_DIRTY)
+        {
+            uniform.modelMat = modelMat;
+            uniform.normalMat = glm::mat3(glm::transpose(glm::inverse(modelMat)));
+        }
+        if (dirty & VIEW_PROJ_DIRTY) uniform.viewProjMat = projectionMat * viewMat;
+        if ((dirty & MATERIAL_DIRTY) || textures.data() != boundTextures || missingTextures)
+        {
+            auto resolve = [&](const std::vector<int>& ids, const Texture** bound)
+            {
+                int count = 0;
+                for (int id : ids)
+                {
+                    if (count >= MAX_BOUND_TEXTURES || id < 0 || id >= (int)textures.size()) continue;
+                    // still decoding, bound once it arrives
+                    if (textures[id] == nullptr) missingTextures = true;
+                    else bound[count++] = textures[id].get();
+                }
+                return count;
+            };
+            missingTextures = false;
+            uniform.diffuseCount = resolve(material.diffuse, uniform.diffuse);
+            uniform.specularCount = resolve(material.specular, uniform.specular);
+            boundTextures = textures.data();
+        }
+        dirty = 0;
+    }
+private:
+    enum { MODEL_DIRTY = 1, VIEW_PROJ_DIRTY = 2, MATERIAL_DIRTY = 4 };
+    glm::mat4 modelMat = glm::mat4(1.f);
+    glm::mat4 viewMat = glm::mat4(1.f);
+    glm::mat4 projectionMat = glm::mat4(1.f);
+    Material material;
+    const TextureHandle* boundTextures = nullptr;
+    bool missingTextures = false;
+    int dirty = MODEL_DIRTY | VIEW_PROJ_DIRTY | MATERIAL_DIRTY;
+};
\ No newline at end of file
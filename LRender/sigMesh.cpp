@@ -1,5 +1,7 @@
 #include "sigMesh.h"
 #include <QDebug>
+#include <algorithm>
+#include <tuple>
 
 bool rayTriangleIntersect(const Vector3D& v0, const Vector3D& v1, const Vector3D& v2, const Vector3D& orig, const Vector3D& dir, float& tnear, float& u, float& v)
 {
@@ -46,7 +48,6 @@ sigMesh::sigMesh(const QString& filename, std::vector<std::string>& texPaths, st
                 specularIds.push_back(getMeshTexture(texPaths.at(k)));
         }
     }
-    if (diffuseIds.size() > 0) *m = tList.at(diffuseIds.at(0));
 
     std::ifstream in, in_forCount;
     in.open(filename.toStdString(), std::ifstream::in);
@@ -197,6 +198,7 @@ sigMesh::sigMesh(const QString& filename, std::vector<std::string>& texPaths, st
         }
         ifAnimation = true;
     }
+    buildVertexBuffer();
     qDebug() << "Model Name:" << QString::fromStdString(meshName);
     qDebug() << "vertex:" << v_count << "normal:" << vn_count << "texture:" << vt_count << "face:" << f_count;
     qDebug() << "joint:" << v_joint << "weight:" << v_weight << "\n";
@@ -253,26 +255,72 @@ void sigMesh::computeNormal()
     }
 }
 
+// corners sharing position, uv and normal collapse into one vertex, so each is transformed once per frame
+void sigMesh::buildVertexBuffer()
+{
+    std::map<std::tuple<int, float, float, float, float, float>, int> vertexIds;
+    vertexBuffer.clear();
+    indexBuffer.clear();
+    indexBuffer.reserve(faces.size() * 3);
+    for (size_t i = 0; i < faces.size(); ++i) {
+        const Vertex* corners[3] = { &faces.at(i).v0, &faces.at(i).v1, &faces.at(i).v2 };
+        for (int k = 0; k < 3; ++k) {
+            const Vertex& ver = *corners[k];
+            auto key = std::make_tuple(faceToVer.at(i).at(k), ver.texUv.x, ver.texUv.y, ver.normal.x, ver.normal.y, ver.normal.z);
+            auto it = vertexIds.find(key);
+            if (it == vertexIds.end()) {
+                it = vertexIds.emplace(key, (int)vertexBuffer.size()).first;
+                vertexBuffer.push_back(ver);
+            }
+            indexBuffer.push_back(it->second);
+        }
+    }
+}
+
+// the decode runs in the background, geometry parsing goes on meanwhile
 int sigMesh::getMeshTexture(std::string t_ps)
 {
     std::ifstream texStream;
     texStream.open(t_ps, std::ifstream::in);
     if (texStream.fail()) return -1;
-    Texture texture;
-    if (texture.getTexture(QString::fromStdString(t_ps)))
-    {
-        qDebug() << QString::fromStdString(t_ps);
-        tList.push_back(texture);
-        return (int)tList.size() - 1;
+    tList.push_back(nullptr);
+    pendingTextures.push_back(TextureCache::instance().loadAsync(t_ps));
+    return (int)tList.size() - 1;
+}
+
+void sigMesh::resolveTextures(bool wait) {
+    for (size_t i = 0; i < pendingTextures.size(); ++i) {
+        if (!pendingTextures.at(i).valid()) continue;
+        if (!wait && pendingTextures.at(i).wait_for(std::chrono::seconds(0)) != std::future_status::ready) continue;
+        tList.at(i) = pendingTextures.at(i).get();
+        pendingTextures.at(i) = std::shared_future<TextureHandle>();
+        // a texture that failed to decode is unbound for good, so the shader stops waiting for it
+        if (tList.at(i) == nullptr) {
+            std::replace(diffuseIds.begin(), diffuseIds.end(), static_cast<int>(i), -1);
+            std::replace(specularIds.begin(), specularIds.end(), static_cast<int>(i), -1);
+            continue;
+        }
+        // the path tracer material takes the first diffuse map
+        if (diffuseIds.size() > 0 && diffuseIds.at(0) == static_cast<int>(i)) *m = *tList.at(i);
     }
-    else return -1;
+}
+
+DrawCall sigMesh::drawCall() {
+    resolveTextures(false);
+    // the draw reads the mesh in place and writes nothing back unless the caller sets output
+    DrawCall call;
+    call.faces = faces.data();
+    call.faceCount = faces.size();
+    call.vertices = vertexBuffer.data();
+    call.vertexCount = vertexBuffer.size();
+    call.indices = indexBuffer.empty() ? nullptr : indexBuffer.data();
+    call.textures = &tList;
+    call.diffuseIds = &diffuseIds;
+    call.specularIds = &specularIds;
+    call.ifAnimation = ifAnimation;
+    return call;
 }
 
 void sigMesh::meshRender() {
-    renderAPI::API().textureList = tList;
-    renderAPI::API().faces = faces;
-    renderAPI::API().shader->material.diffuse = diffuseIds;
-    renderAPI::API().shader->material.specular = specularIds;
-    renderAPI::API().render(ifAnimation);
-    app_ani_faces = renderAPI::API().faces;
+    renderAPI::API().render(drawCall());
 }
@@ -2,7 +2,8 @@
 #define MESH_H
 
 #include <QString>
-#include "texture.h"
+#include <map>
+#include "Texture.h"
 #include "BVH.h"
 #include "renderAPI.h"
 
@@ -13,6 +14,10 @@ class sigMesh : public BVHItem {
 public:
     std::vector<Vertex> vertices;
     std::vector<Triangle> faces;
+    // unique (position, uv, normal) vertices and three indices per face for indexed drawing
+    std::vector<Vertex> vertexBuffer;
+    std::vector<int> indexBuffer;
+    // transformed faces of the last capture, only filled for the ray tracer
     std::vector<Triangle> app_ani_faces;
     std::map<int, std::vector<int>> verToFace;
     std::map<int, std::vector<int>> faceToVer;
@@ -24,7 +29,10 @@ public:
     std::vector<int> specularIds;
     bool ifAnimation = false;
 
-    std::vector<Texture> tList;
+    // handles into the shared texture cache, the material ids index this list. entries stay null
+    // until their background decode finishes, drawCall picks finished ones up without waiting
+    std::vector<TextureHandle> tList;
+    std::vector<std::shared_future<TextureHandle>> pendingTextures;
     Texture* m;
 
     float minX_sig{ FLT_MAX };
@@ -44,8 +52,11 @@ public:
     sigMesh(const QString& filename, std::vector<std::string>& texPaths, std::string& meshName, Texture* mt = new Texture(DIFFUSE_T, Vector3D(0.0f)));
     sigMesh(const sigMesh& mesh);
     void computeNormal();
+    void buildVertexBuffer();
     void computeBVH();
     int getMeshTexture(std::string t_ps);
+    void resolveTextures(bool wait);
+    DrawCall drawCall();
     void meshRender();
 
     bool intersect(const Ray& ray) { return true; }
@@ -1,7 +1,7 @@
 #ifndef SKELETON_H
 #define SKELETON_H
 
-#include <qDebug>
+#include <QDebug>
 #include "tools.h"
 
 #define LINE_SIZE 256
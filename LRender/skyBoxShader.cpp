@@ -27,3 +27,12 @@ void SkyBoxShader::fragmentShader(Fragment& fragment, int faceId)
     Color result = renderAPI::API().skyBoxTexture[faceId / 2.0].getColorFromUv(fragment.texUv);
     fragment.fragmentColor = result;
 }
+
+// the box only samples its face texture, so a batch resolves the texture once. the fetches
+// themselves stay scalar per lane, there is no per-lane math here for simd to take over
+void SkyBoxShader::fragmentShader(FragmentBatch& batch, int faceId)
+{
+    Texture& texture = renderAPI::API().skyBoxTexture[faceId / 2];
+    for (int lane = 0; lane < batch.count; lane++)
+        batch.setColor(lane, texture.getColorFromUv(Coord2D(batch.u[lane], batch.v[lane])));
+}
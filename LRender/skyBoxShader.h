@@ -1,7 +1,7 @@
 #pragma once
 
 #include "shader.h"
-#include "texture.h"
+#include "Texture.h"
 
 class SkyBoxShader
 {
@@ -14,4 +14,5 @@ public:
     Coord3D eyePos;
     void vertexShader(Vertex &vertex);
     void fragmentShader(Fragment& fragment, int faceId);
+    void fragmentShader(FragmentBatch& batch, int faceId);
 };
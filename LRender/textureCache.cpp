@@ -0,0 +1,175 @@
+#include "textureCache.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <QDebug>
+
+static uint64_t fnv1a(const std::vector<char>& bytes)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char c : bytes)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static bool sameBytes(const std::vector<char>& a, const std::vector<char>& b)
+{
+    return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size()) == 0);
+}
+
+TextureHandle TextureCache::find(const std::string& canonicalPath, const ContentKey* content, const std::vector<char>* bytes)
+{
+    auto byPathIt = byPath.find(canonicalPath);
+    if (byPathIt != byPath.end())
+        if (TextureHandle handle = byPathIt->second.lock()) return handle;
+    if (content == nullptr) return nullptr;
+    auto byContentIt = byContent.find(*content);
+    if (byContentIt != byContent.end() && sameBytes(*byContentIt->second.bytes, *bytes))
+    {
+        if (TextureHandle handle = byContentIt->second.texture.lock())
+        {
+            // same bytes under another name
+            byPath[canonicalPath] = handle;
+            return handle;
+        }
+    }
+    return nullptr;
+}
+
+std::string TextureCache::canonical(const std::string& path)
+{
+    std::error_code error;
+    std::string canonicalPath = std::filesystem::weakly_canonical(path, error).string();
+    return error ? path : canonicalPath;
+}
+
+TextureHandle TextureCache::load(const std::string& path)
+{
+    std::string canonicalPath = canonical(path);
+    TextureLayout layout;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if (TextureHandle handle = find(canonicalPath, nullptr, nullptr)) return handle;
+        layout = residency;
+    }
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return nullptr;
+    auto bytes = std::make_shared<const std::vector<char>>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    ContentKey content = { fnv1a(*bytes), bytes->size() };
+    std::shared_future<TextureHandle> running;
+    std::promise<TextureHandle> decoded;
+    bool owner = false;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if (TextureHandle handle = find(canonicalPath, &content, bytes.get())) return handle;
+        auto entry = byContent.find(content);
+        bool collision = entry != byContent.end() && !sameBytes(*entry->second.bytes, *bytes)
+            && (entry->second.decoding.valid() || !entry->second.texture.expired());
+        if (entry != byContent.end() && !collision && entry->second.decoding.valid())
+        {
+            running = entry->second.decoding;
+        }
+        else if (!collision)
+        {
+            // the decode is announced before it starts, later loads of the same bytes wait for it.
+            // entries of released textures are dropped here so their bytes do not pile up
+            for (auto it = byContent.begin(); it != byContent.end();)
+                it = it->second.texture.expired() && !it->second.decoding.valid() ? byContent.erase(it) : std::next(it);
+            byContent[content] = { bytes, {}, decoded.get_future().share() };
+            owner = true;
+        }
+    }
+    if (running.valid())
+    {
+        // the owner is already decoding and never waits itself, so this cannot block forever
+        TextureHandle handle = running.get();
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if (handle != nullptr) byPath[canonicalPath] = handle;
+        return handle;
+    }
+    // decoded outside the lock. on a real collision the live entry stays and this texture is only found by its path
+    auto texture = std::make_shared<Texture>();
+    TextureHandle handle;
+    // isolated so the decode's own parallel loops never pick up a queued load that waits on this one
+    bool decodedOk = tbb::this_task_arena::isolate([&]()
+        {
+            return texture->getTexture(reinterpret_cast<const uchar*>(bytes->data()), static_cast<int>(bytes->size()), QString::fromStdString(path), layout);
+        });
+    if (decodedOk) handle = texture;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if (handle != nullptr) byPath[canonicalPath] = handle;
+        auto entry = byContent.find(content);
+        // setLayout may have dropped the entry meanwhile
+        if (owner && entry != byContent.end() && entry->second.bytes == bytes)
+        {
+            if (handle != nullptr)
+            {
+                entry->second.texture = handle;
+                entry->second.decoding = std::shared_future<TextureHandle>();
+            }
+            else byContent.erase(entry);
+        }
+    }
+    if (owner) decoded.set_value(handle);
+    if (handle != nullptr) qDebug() << QString::fromStdString(path);
+    return handle;
+}
+
+std::shared_future<TextureHandle> TextureCache::loadAsync(const std::string& path)
+{
+    std::string canonicalPath = canonical(path);
+    auto promise = std::make_shared<std::promise<TextureHandle>>();
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (TextureHandle handle = find(canonicalPath, nullptr, nullptr))
+    {
+        promise->set_value(handle);
+        return promise->get_future().share();
+    }
+    auto running = pending.find(canonicalPath);
+    if (running != pending.end()) return running->second;
+    std::shared_future<TextureHandle> future = promise->get_future().share();
+    pending[canonicalPath] = future;
+    // enqueued work gets a worker even on a single core, so a thread blocked on the future
+    // without joining the arena still sees it finish
+    decodeArena.enqueue([this, path, canonicalPath, promise]()
+        {
+            TextureHandle handle = load(path);
+            {
+                std::lock_guard<std::mutex> lock(cacheMutex);
+                pending.erase(canonicalPath);
+            }
+            // the cache is not touched after the entry is gone, the destructor relies on that
+            promise->set_value(handle);
+        });
+    return future;
+}
+
+TextureCache::~TextureCache()
+{
+    // wait for the decodes still in flight
+    for (;;)
+    {
+        std::shared_future<TextureHandle> running;
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            if (pending.empty()) break;
+            running = pending.begin()->second;
+        }
+        running.wait();
+    }
+}
+
+void TextureCache::setLayout(TextureLayout layout)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (layout == residency) return;
+    residency = layout;
+    // later loads decode again in the new layout instead of sharing the old textures
+    byPath.clear();
+    byContent.clear();
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <future>
+#include <tbb/task_arena.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Texture.h"
+
+// shared ownership of a decoded texture, the cache only keeps weak references
+// so a texture is released with the last mesh that uses it
+using TextureHandle = std::shared_ptr<const Texture>;
+
+// process wide texture cache, an image is decoded once per canonical path and once per
+// distinct content, byte identical files under different names share one texture
+class TextureCache
+{
+public:
+    static TextureCache& instance()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+    // null when the file cannot be read or decoded, safe to call from several threads
+    TextureHandle load(const std::string& path);
+    // decode on a background task, a path already loading shares the running task
+    std::shared_future<TextureHandle> loadAsync(const std::string& path);
+    // texel layout of textures decoded from now on, textures already in use keep theirs
+    void setLayout(TextureLayout layout);
+
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+private:
+    TextureCache() = default;
+    ~TextureCache();
+    static std::string canonical(const std::string& path);
+    // fnv-1a hash and length of the file bytes
+    struct ContentKey
+    {
+        uint64_t hash;
+        uint64_t size;
+        bool operator==(const ContentKey& o) const { return hash == o.hash && size == o.size; }
+    };
+    struct ContentKeyHash
+    {
+        size_t operator()(const ContentKey& key) const { return static_cast<size_t>(key.hash ^ (key.size * 0x9e3779b97f4a7c15ull)); }
+    };
+    // the file bytes are kept with the texture, a hash hit only counts when they match.
+    // decoding is set while the first load of the content runs
+    struct ContentEntry
+    {
+        std::shared_ptr<const std::vector<char>> bytes;
+        std::weak_ptr<const Texture> texture;
+        std::shared_future<TextureHandle> decoding;
+    };
+    TextureHandle find(const std::string& canonicalPath, const ContentKey* content, const std::vector<char>* bytes);
+    std::mutex cacheMutex;
+    std::unordered_map<std::string, std::weak_ptr<const Texture>> byPath;
+    std::unordered_map<ContentKey, ContentEntry, ContentKeyHash> byContent;
+    std::unordered_map<std::string, std::shared_future<TextureHandle>> pending;
+    tbb::task_arena decodeArena;
+    TextureLayout residency = LAYOUT_TILED;
+};
@@ -1,4 +1,5 @@
 #include "tools.h"
+#include <cstring>
 
 std::vector<std::string> splitString(const std::string& str, const std::string& delim) {
     std::vector<std::string> res;
@@ -83,7 +84,31 @@ std::vector<Triangle> constructTriangle(std::vector<Vertex> vertexList)
     return res;
 }
 
-Fragment interpolationFragment(int x, int y, float z, Triangle& tri, Vector3D& barycentric)
+UvGradient uvGradient(const Triangle& tri)
+{
+    UvGradient gradient = {};
+    float x0 = tri.v0.screenPos.x, y0 = tri.v0.screenPos.y;
+    float x1 = tri.v1.screenPos.x, y1 = tri.v1.screenPos.y;
+    float x2 = tri.v2.screenPos.x, y2 = tri.v2.screenPos.y;
+    float det = (y1 - y2) * (x0 - x2) + (x2 - x1) * (y0 - y2);
+    if (det == 0.f) return gradient;
+    float w[3] = { tri.v0.clipPos.w * det, tri.v1.clipPos.w * det, tri.v2.clipPos.w * det };
+    gradient.dx[0] = (y1 - y2) / w[0]; gradient.dx[1] = (y2 - y0) / w[1]; gradient.dx[2] = (y0 - y1) / w[2];
+    gradient.dy[0] = (x2 - x1) / w[0]; gradient.dy[1] = (x0 - x2) / w[1]; gradient.dy[2] = (x1 - x0) / w[2];
+    return gradient;
+}
+
+// d(uv)/dx = sum(dl_i/dx / w_i * (uv_i - uv)) / sum(l_i / w_i), only the uv differences vary per fragment
+static inline void uvDerivatives(const Triangle& tri, const UvGradient& gradient, float invSum, const Coord2D& uv, Coord2D& dx, Coord2D& dy)
+{
+    Coord2D e0 = tri.v0.texUv - uv;
+    Coord2D e1 = tri.v1.texUv - uv;
+    Coord2D e2 = tri.v2.texUv - uv;
+    dx = (gradient.dx[0] * e0 + gradient.dx[1] * e1 + gradient.dx[2] * e2) * invSum;
+    dy = (gradient.dy[0] * e0 + gradient.dy[1] * e1 + gradient.dy[2] * e2) * invSum;
+}
+
+Fragment interpolationFragment(int x, int y, float z, Triangle& tri, Vector3D& barycentric, const UvGradient& gradient)
 {
     Fragment frag;
     frag.screenPos.x = x;
@@ -106,6 +131,36 @@ Fragment interpolationFragment(int x, int y, float z, Triangle& tri, Vector3D& b
     frag.texUv += tri.v0.texUv * bc_corrected[0];
     frag.texUv += tri.v1.texUv * bc_corrected[1];
     frag.texUv += tri.v2.texUv * bc_corrected[2];
+    uvDerivatives(tri, gradient, Z_n, frag.texUv, frag.texDx, frag.texDy);
 
     return frag;
+}
+
+void interpolationFragment(FragmentBatch& batch, int x, int y, float z, Triangle& tri, Vector3D& barycentric, const UvGradient& gradient)
+{
+    int lane = batch.count++;
+    batch.x[lane] = x;
+    batch.y[lane] = y;
+    batch.zValue[lane] = z;
+
+    float b0 = barycentric[0] / tri.v0.clipPos.w;
+    float b1 = barycentric[1] / tri.v1.clipPos.w;
+    float b2 = barycentric[2] / tri.v2.clipPos.w;
+    float Z_n = 1.f / (b0 + b1 + b2);
+    b0 *= Z_n; b1 *= Z_n; b2 *= Z_n;
+
+    batch.worldX[lane] = tri.v0.worldPos.x * b0 + tri.v1.worldPos.x * b1 + tri.v2.worldPos.x * b2;
+    batch.worldY[lane] = tri.v0.worldPos.y * b0 + tri.v1.worldPos.y * b1 + tri.v2.worldPos.y * b2;
+    batch.worldZ[lane] = tri.v0.worldPos.z * b0 + tri.v1.worldPos.z * b1 + tri.v2.worldPos.z * b2;
+    batch.normalX[lane] = tri.v0.normal.x * b0 + tri.v1.normal.x * b1 + tri.v2.normal.x * b2;
+    batch.normalY[lane] = tri.v0.normal.y * b0 + tri.v1.normal.y * b1 + tri.v2.normal.y * b2;
+    batch.normalZ[lane] = tri.v0.normal.z * b0 + tri.v1.normal.z * b1 + tri.v2.normal.z * b2;
+    batch.u[lane] = tri.v0.texUv.x * b0 + tri.v1.texUv.x * b1 + tri.v2.texUv.x * b2;
+    batch.v[lane] = tri.v0.texUv.y * b0 + tri.v1.texUv.y * b1 + tri.v2.texUv.y * b2;
+    Coord2D dx, dy;
+    uvDerivatives(tri, gradient, Z_n, Coord2D(batch.u[lane], batch.v[lane]), dx, dy);
+    batch.dudx[lane] = dx.x;
+    batch.dvdx[lane] = dx.y;
+    batch.dudy[lane] = dy.x;
+    batch.dvdy[lane] = dy.y;
 }
\ No newline at end of file
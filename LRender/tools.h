@@ -5,7 +5,7 @@
 #include <sstream>
 #include <filesystem>
 #include <bitset>
-#include <qDebug>
+#include <QDebug>
 #include "triangle.h"
 
 using namespace std::filesystem;
@@ -22,4 +22,17 @@ Coord2D interpolate(float alpha, float beta, float gamma, const Coord2D& vert1,
 
 std::vector<Triangle> constructTriangle(std::vector<Vertex> vertexList);
 
-Fragment interpolationFragment(int x, int y, float z, Triangle& tri, Vector3D& barycentric);
\ No newline at end of file
+// screen space barycentric slopes divided by the vertex w, constant over a triangle
+struct UvGradient
+{
+    float dx[3];
+    float dy[3];
+};
+
+// computed once per triangle, zero for a degenerate one
+UvGradient uvGradient(const Triangle& tri);
+
+Fragment interpolationFragment(int x, int y, float z, Triangle& tri, Vector3D& barycentric, const UvGradient& gradient);
+
+// interpolate into the next free lane of a batch
+void interpolationFragment(FragmentBatch& batch, int x, int y, float z, Triangle& tri, Vector3D& barycentric, const UvGradient& gradient);
\ No newline at end of file
@@ -1,6 +1,6 @@
 #pragma once
 #include "lrenderBasicCore.h"
-#include "texture.h"
+#include "Texture.h"
 
 class BVHItem;
 class Texture;